@@ -15,6 +15,11 @@ typedef enum metric {
     METRIC_AI_INTERRUPT,
     METRIC_DP_INTERRUPT,
     METRIC_SP_INTERRUPT,
+    METRIC_CODECACHE_EVICTION,
+    METRIC_CODECACHE_BYTES_USED,
+    METRIC_DYNAREC_METADATA_BYTES,
+    METRIC_BLOCK_CACHE_INSTALL,
+    METRIC_TRACE_COMPILATION,
     NUM_METRICS
 } metric_t;
 
@@ -2,6 +2,7 @@
 #define N64_ASM_EMITTER_H
 
 #include "dynarec.h"
+#include "dynarec_cache.h"
 #include <system/n64system.h>
 #include <dynasm/dasm_proto.h>
 
@@ -161,27 +162,78 @@ COMPILER(mips_cp_c_lt_s);
 COMPILER(mips_cp_c_le_d);
 COMPILER(mips_cp_c_le_s);
 
-dasm_State* block_header();
+// Emits code to write back any guest registers cached in host registers, on a path that leaves the block.
+typedef void (*dynarec_writeback_t)(dasm_State** Dst);
+
+// Dynamic label at the start of every block's body, just after the prologue.
+#define BLOCK_BODY_LABEL 0
+
+// A block can't be longer than a page plus a delay slot, and each instruction has at most one fastmem site.
+#define MAX_FASTMEM_SITES (BLOCKCACHE_INNER_SIZE + 1)
+// Plenty for a store with a fastpath, the most any single instruction needs, for every instruction in a block.
+#define MAX_HOST_ADDRESSES (8 * (BLOCKCACHE_INNER_SIZE + 1))
+// Instructions that can raise an exception call into the interpreter from one place, their slow path.
+#define MAX_EXCEPTION_SITES (BLOCKCACHE_INNER_SIZE + 1)
+
+// Everything the emitter keeps about the block being compiled is per thread, so blocks can be compiled on the
+// dynarec worker at the same time as on the emulation thread.
+// CPU blocks also save their stack frame to N64DYNAREC->exception_frame.
+dasm_State* block_header(bool cpu_block);
+int alloc_dynamic_label(dasm_State** Dst);
+void* get_dynamic_label_address(dasm_State** Dst, void* code, int label);
+void register_fastmem_sites(dasm_State** Dst, void* code);
+void register_exception_sites(dasm_State** Dst, void* code);
+// For saving the block that was just encoded to the translation cache, return how many were written.
+// Offsets are from the start of the block's code.
+int get_fastmem_site_offsets(dasm_State** Dst, dynarec_cached_site_t* offsets);
+int get_exception_site_offsets(dasm_State** Dst, dynarec_cached_exception_site_t* offsets);
+int get_host_address_relocs(dasm_State** Dst, dynarec_reloc_t* relocs);
+// Changes whenever the code the emitter generates does.
+dword emitter_fingerprint();
 void clear_branch_flag(dasm_State** Dst);
 void advance_pc(dasm_State** Dst);
 void advance_rsp_pc(dasm_State** Dst);
 dynarec_ir_t* instruction_ir(mips_instruction_t instr, word address);
 dynarec_ir_t* rsp_instruction_ir(mips_instruction_t instr, word address);
 void end_block(dasm_State** Dst, int block_length);
+void end_block_linked(dasm_State** Dst, int block_length, dword* targets, int* link_labels, int num_targets);
+void end_block_indirect(dasm_State** Dst, int block_length, bool is_return);
+void push_return_address(dasm_State** Dst, dword return_address);
 void end_rsp_block(dasm_State** Dst, int block_length);
-void post_branch_likely(dasm_State** Dst, int block_length);
-void check_exception(dasm_State** Dst, word block_length);
+void post_branch_likely(dasm_State** Dst, int block_length, dword* targets, int* link_labels, int num_targets, dynarec_writeback_t writeback);
+void run_pending_delay_slots(dasm_State** Dst);
+void count_block_run(dasm_State** Dst, dword virtual_address, word physical_address);
+void snapshot_code_writes(dasm_State** Dst);
+void check_code_writes(dasm_State** Dst, int block_length, bool in_delay_slot, dword next_pc, dynarec_writeback_t writeback);
+void trace_guard(dasm_State** Dst, int block_length, dword expected_pc, dword* targets, int* link_labels, int num_targets, dynarec_writeback_t writeback);
+void skip_idle_loop(dasm_State** Dst, int block_length, dword loop_address);
+void check_exception(dasm_State** Dst, word block_length, dynarec_writeback_t writeback);
+void emit_known_branch(dasm_State** Dst, mips_instruction_t instr, bool taken);
+// FR the block will run with, FPU register accesses are laid out for it. Defaults to off for each block.
+void set_compiled_fr(bool fr);
+void set_known_memory_address(bool known, dword address);
+// Guest PC of the instruction being compiled, if it can raise an exception. Its calls into the interpreter are recorded
+// with it, see dynarec_exception_pc().
+void set_exception_pc(bool possible, dword pc);
 void set_prev_branch_flag(dasm_State** Dst, bool value);
 #ifdef N64_DEBUG_MODE
 void check_exception_sanity(dasm_State** Dst, word block_length);
 #endif
-void flush_prev_pc(dasm_State** Dst, dword prev_pc);
 void flush_pc(dasm_State** Dst, dword pc);
 void flush_next_pc(dasm_State** Dst, dword next_pc);
 void flush_rsp_prev_pc(dasm_State** Dst, half prev_pc);
 void flush_rsp_pc(dasm_State** Dst, half pc);
 void flush_rsp_next_pc(dasm_State** Dst, half next_pc);
 void fill_valid_host_regs(int* valid_host_regs, int* num_valid_host_regs);
+bool is_host_reg_callee_saved(int host_reg);
 void load_host_register_from_gpr(dasm_State** Dst, byte host_reg, int guest_reg);
+void load_host_register_constant(dasm_State** Dst, int host_reg, dword value);
 void flush_host_register_to_gpr(dasm_State** Dst, int host_reg, int guest_reg);
+// Only the low 32 bits are valid, sign extends them into the whole register.
+void sign_extend_host_register(dasm_State** Dst, int host_reg);
+// xmm0-xmm4 are scratch registers for the RSP vector compilers, the rest can cache vector unit state.
+#define RSP_VU_FIRST_HOST_XMM 5
+#define RSP_VU_NUM_HOST_XMM 11
+void load_rsp_vu_slot(dasm_State** Dst, int host_xmm, int slot);
+void flush_rsp_vu_slot(dasm_State** Dst, int host_xmm, int slot);
 #endif //N64_ASM_EMITTER_H
@@ -5,10 +5,13 @@
 #include <metrics.h>
 #include "cpu/dynarec/asm_emitter.h"
 #include "dynarec_memory_management.h"
+#include "dynarec_cache.h"
+#include "dynarec_worker.h"
+#include "fastmem.h"
 
 #define IS_PAGE_BOUNDARY(address) ((address & (BLOCKCACHE_PAGE_SIZE - 1)) == 0)
 
-static void* link_and_encode(dasm_State** d) {
+static void* link_and_encode(dasm_State** d, size_t* code_size_out) {
     size_t code_size;
     dasm_link(d, &code_size);
 #ifdef N64_LOG_COMPILATIONS
@@ -16,113 +19,280 @@ static void* link_and_encode(dasm_State** d) {
 #endif
     void* buf = dynarec_bumpalloc(code_size);
     dasm_encode(d, buf);
+    register_fastmem_sites(d, buf);
+    register_exception_sites(d, buf);
 
+    *code_size_out = code_size;
     return buf;
 }
 
-static int arg_host_registers[] = {0, 0};
-static int dest_host_register = 0;
+// The instructions in the block currently being compiled, filled in by scan_block() before any code is emitted.
+typedef struct dynarec_block_instr {
+    mips_instruction_t instr;
+    dynarec_ir_t* ir;
+    dword virtual_address;
+    word physical_address;
+    word gpr_reads; // Guest registers that may be read
+    word gpr_writes; // Guest registers that may be written
+    word gpr_kills; // Guest registers that are definitely written
+    word gpr_live_after; // Guest registers whose values are still needed after this instruction
+
+    // Filled in by propagate_constants()
+    bool address_known; // Effective address of a load/store
+    dword address;
+    bool result_known; // Value written to the destination register
+    int result_reg;
+    dword result;
+    bool branch_known; // Whether a conditional branch is taken
+    bool branch_taken;
+
+    // Filled in by form_trace()
+    bool trace_guard; // A branch the trace continues past, to trace_next
+    dword trace_next;
+    bool code_write_check; // A store the trace continues past
+} dynarec_block_instr_t;
+
+// Traces can leave at every branch they continue past, as well as at the end.
+#define MAX_TRACE_LINKS (TRACE_MAX_SEGMENTS + 3)
+
+// Everything about the block being compiled is per thread, since blocks can also be compiled on the dynarec worker.
+static _Thread_local dynarec_block_instr_t block_instrs[MAX_BLOCK_INSTRS];
+
+#define ALL_GPRS 0xFFFFFFFF
+#define GPR_BIT(r) (1u << (r))
+
+static _Thread_local int arg_host_registers[] = {0, 0};
+static _Thread_local int dest_host_register = 0;
+
+// Host registers available for caching guest registers. Indexes into this are what the rest of the allocator uses.
+// Filled in once by n64_dynarec_init(), so shared between threads.
 static int valid_host_regs[32];
 static int num_valid_host_regs;
-static int num_available_host_regs;
-static bool guest_reg_loaded[32];
-static bool host_reg_used[32];
-static int guest_reg_to_host_reg[32];
+
+typedef struct host_reg_state {
+    int guest; // -1 if free
+    bool dirty; // Needs to be written back to cpu_state->gpr before it can be dropped
+    bool callee_saved; // Survives calls out to the interpreter
+    bool unextended; // Only the low 32 bits are valid, sign extended the first time the whole register is needed
+    int last_used; // Index of the last instruction that used it, for LRU spilling
+} host_reg_state_t;
+
+static _Thread_local host_reg_state_t host_regs[32];
+static _Thread_local int guest_reg_to_host_reg[32]; // -1 if the guest register isn't cached
+static _Thread_local word pinned_host_regs; // Being used by the current instruction, so can't be spilled
+static _Thread_local int current_instr;
 
 INLINE bool is_reg_loaded(int guest) {
-    return guest_reg_loaded[guest];
+    return guest_reg_to_host_reg[guest] >= 0;
 }
 
-INLINE bool is_reg_used(int host) {
-    return host_reg_used[host];
+INLINE bool is_gpr_live(int guest) {
+    word needed = block_instrs[current_instr].gpr_live_after | block_instrs[current_instr].gpr_reads;
+    return (needed & GPR_BIT(guest)) != 0;
 }
 
-INLINE int get_valid_host_reg() {
+static void reset_host_regs() {
     for (int r = 0; r < num_valid_host_regs; r++) {
-        if (!is_reg_used(r)) {
-            return r;
-        }
+        host_regs[r].guest = -1;
+        host_regs[r].dirty = false;
+        host_regs[r].unextended = false;
+        host_regs[r].callee_saved = is_host_reg_callee_saved(valid_host_regs[r]);
+        host_regs[r].last_used = -1;
+    }
+    for (int g = 0; g < 32; g++) {
+        guest_reg_to_host_reg[g] = -1;
     }
+    pinned_host_regs = 0;
+}
 
-    logfatal("Ran out of valid host regs! Should have flushed!");
+// Makes the whole host register valid, for anything that reads all 64 bits of it.
+INLINE void extend_host_reg(dasm_State** Dst, int host) {
+    if (host_regs[host].unextended) {
+        sign_extend_host_register(Dst, valid_host_regs[host]);
+        host_regs[host].unextended = false;
+    }
 }
 
+INLINE void writeback_reg(dasm_State** Dst, int guest) {
+    int host = guest_reg_to_host_reg[guest];
+    if (host >= 0 && host_regs[host].dirty) {
+        extend_host_reg(Dst, host);
+        flush_host_register_to_gpr(Dst, valid_host_regs[host], guest);
+        host_regs[host].dirty = false;
+    }
+}
+
+// Stops caching the guest register, writing it back first if it's still needed.
 INLINE void flush_reg(dasm_State** Dst, int guest) {
-    if (is_reg_loaded(guest)) {
-        int host_reg = guest_reg_to_host_reg[guest];
-        flush_host_register_to_gpr(Dst, valid_host_regs[host_reg], guest);
-        num_available_host_regs++;
+    int host = guest_reg_to_host_reg[guest];
+    if (host >= 0) {
+        if (host_regs[host].dirty && is_gpr_live(guest)) {
+            extend_host_reg(Dst, host);
+            flush_host_register_to_gpr(Dst, valid_host_regs[host], guest);
+        }
+        host_regs[host].guest = -1;
+        host_regs[host].dirty = false;
+        guest_reg_to_host_reg[guest] = -1;
+    }
+}
+
+INLINE void flush_all(dasm_State** Dst) {
+    for (int r = 0; r < 32; r++) {
+        flush_reg(Dst, r);
     }
-    guest_reg_loaded[guest] = false;
-    host_reg_used[guest_reg_to_host_reg[guest]] = false;
 }
 
-INLINE int load_reg(dasm_State** Dst, int guest) {
-    if (!is_reg_loaded(guest)) {
-        guest_reg_loaded[guest] = true;
-        int host_reg = get_valid_host_reg();
-        num_available_host_regs--;
+// Writes back everything that's dirty without touching the generated code's view of the registers.
+// Used on paths that leave the block early.
+static void emit_exit_writeback(dasm_State** Dst) {
+    for (int g = 0; g < 32; g++) {
+        int host = guest_reg_to_host_reg[g];
+        if (host >= 0 && host_regs[host].dirty) {
+            if (host_regs[host].unextended) {
+                sign_extend_host_register(Dst, valid_host_regs[host]);
+            }
+            flush_host_register_to_gpr(Dst, valid_host_regs[host], g);
+        }
+    }
+}
 
-        guest_reg_to_host_reg[guest] = host_reg;
-        host_reg_used[host_reg] = true;
+static int alloc_host_reg(dasm_State** Dst) {
+    // Prefer callee saved registers, they don't need to be spilled around calls to the interpreter.
+    for (int pass = 0; pass < 2; pass++) {
+        for (int r = 0; r < num_valid_host_regs; r++) {
+            if (host_regs[r].guest < 0 && host_regs[r].callee_saved == (pass == 0)) {
+                return r;
+            }
+        }
+    }
 
-        load_host_register_from_gpr(Dst, valid_host_regs[host_reg], guest);
+    // Nothing free. Take one holding a dead value if there is one, otherwise the least recently used.
+    int victim = -1;
+    for (int r = 0; r < num_valid_host_regs; r++) {
+        if (pinned_host_regs & GPR_BIT(r)) {
+            continue;
+        }
+        if (!is_gpr_live(host_regs[r].guest)) {
+            victim = r;
+            break;
+        }
+        if (victim < 0 || host_regs[r].last_used < host_regs[victim].last_used) {
+            victim = r;
+        }
     }
-    int valid_host_reg = valid_host_regs[guest_reg_to_host_reg[guest]];
-    return valid_host_reg;
+
+    if (victim < 0) {
+        logfatal("Ran out of valid host regs!");
+    }
+
+    flush_reg(Dst, host_regs[victim].guest);
+    return victim;
 }
 
-INLINE void flush_all(dasm_State** Dst) {
-    for (int r = 0; r < 32; r++) {
-        if (is_reg_loaded(r)) {
-            flush_reg(Dst, r);
+INLINE int map_reg(dasm_State** Dst, int guest, bool load) {
+    int host = guest_reg_to_host_reg[guest];
+    if (host < 0) {
+        host = alloc_host_reg(Dst);
+        host_regs[host].guest = guest;
+        host_regs[host].dirty = false;
+        host_regs[host].unextended = false;
+        guest_reg_to_host_reg[guest] = host;
+        if (load) {
+            load_host_register_from_gpr(Dst, valid_host_regs[host], guest);
         }
     }
+    host_regs[host].last_used = current_instr;
+    pinned_host_regs |= GPR_BIT(host);
+    return host;
 }
 
-INLINE void load_reg_1(dasm_State** Dst, int* dest1, int r1) {
-    bool r1_loaded = is_reg_loaded(r1);
+// Host register holding the current value of a guest register, loading it if needed.
+INLINE int use_reg(dasm_State** Dst, int guest) {
+    int host = map_reg(Dst, guest, true);
+    extend_host_reg(Dst, host);
+    return valid_host_regs[host];
+}
 
-    if (num_available_host_regs >= 1 || r1_loaded) {
-        *dest1 = load_reg(Dst, r1);
-    } else {
-        flush_all(Dst);
-        *dest1 = load_reg(Dst, r1);
+// Same as use_reg(), for instructions that only read the low 32 bits, so the value doesn't have to be sign extended.
+INLINE int use_reg_low32(dasm_State** Dst, int guest) {
+    return valid_host_regs[map_reg(Dst, guest, true)];
+}
+
+INLINE int use_operand(dasm_State** Dst, int guest, value_width_t width) {
+    return width == WIDTH_32 ? use_reg_low32(Dst, guest) : use_reg(Dst, guest);
+}
+
+// Host register the new value of a guest register should be written to. Doesn't load the old value.
+INLINE int def_reg(dasm_State** Dst, int guest) {
+    int host = map_reg(Dst, guest, false);
+    if (guest != 0) {
+        host_regs[host].dirty = true;
     }
+    host_regs[host].unextended = false;
+    return valid_host_regs[host];
 }
 
-INLINE void load_reg_2(dasm_State** Dst, int* dest1, int r1, int* dest2, int r2) {
-    bool r1_loaded = is_reg_loaded(r1);
-    bool r2_loaded = is_reg_loaded(r2);
+// After an instruction that leaves the upper half of its result undefined.
+INLINE void mark_unextended(int guest) {
+    int host = guest_reg_to_host_reg[guest];
+    if (guest != 0 && host >= 0) {
+        host_regs[host].unextended = true;
+    }
+}
 
-    if (num_available_host_regs >= 2 || (r1_loaded && r2_loaded)) {
-        *dest1 = load_reg(Dst, r1);
-        *dest2 = load_reg(Dst, r2);
-    } else {
-        flush_all(Dst);
-        *dest1 = load_reg(Dst, r1);
-        *dest2 = load_reg(Dst, r2);
+// Called before an instruction that calls out to the interpreter. The interpreter reads and writes guest registers
+// in memory, and the call trashes the caller saved host registers.
+static void prepare_interpreter_call(dasm_State** Dst, dynarec_block_instr_t* bi) {
+    for (int g = 0; g < 32; g++) {
+        int host = guest_reg_to_host_reg[g];
+        if (host < 0) {
+            continue;
+        }
+        if (!host_regs[host].callee_saved) {
+            flush_reg(Dst, g);
+        } else if ((bi->gpr_reads | bi->gpr_writes) & GPR_BIT(g)) {
+            if (is_gpr_live(g)) {
+                writeback_reg(Dst, g);
+            } else {
+                flush_reg(Dst, g);
+            }
+        }
     }
 }
 
-INLINE void load_reg_3(dasm_State** Dst, int* dest1, int r1, int* dest2, int r2, int* dest3, int r3) {
-    bool r1_loaded = is_reg_loaded(r1);
-    bool r2_loaded = is_reg_loaded(r2);
-    bool r3_loaded = is_reg_loaded(r3);
+// Called after an instruction that calls out to the interpreter, anything it might have written is stale.
+static void finish_interpreter_call(dynarec_block_instr_t* bi) {
+    for (int g = 0; g < 32; g++) {
+        int host = guest_reg_to_host_reg[g];
+        if (host >= 0 && (bi->gpr_writes & GPR_BIT(g))) {
+            // Already written back by prepare_interpreter_call()
+            host_regs[host].guest = -1;
+            guest_reg_to_host_reg[g] = -1;
+        }
+    }
+}
 
-    if (num_available_host_regs >= 3 || (r1_loaded && r2_loaded && r3_loaded)) {
-        *dest1 = load_reg(Dst, r1);
-        *dest2 = load_reg(Dst, r2);
-        *dest3 = load_reg(Dst, r3);
-    } else {
-        flush_all(Dst);
-        *dest1 = load_reg(Dst, r1);
-        *dest2 = load_reg(Dst, r2);
-        *dest3 = load_reg(Dst, r3);
+// Stops caching anything that won't be read again before it's overwritten. Dirty values are dropped without being
+// written back.
+static void drop_dead_regs() {
+    word live = block_instrs[current_instr].gpr_live_after;
+    for (int g = 0; g < 32; g++) {
+        int host = guest_reg_to_host_reg[g];
+        if (host >= 0 && (g == 0 || !(live & GPR_BIT(g)))) {
+            host_regs[host].guest = -1;
+            host_regs[host].dirty = false;
+            guest_reg_to_host_reg[g] = -1;
+        }
     }
 }
 
-bool branch_is_loop(mips_instruction_t instr, word block_length) {
+// Blocks are only linked to targets in KSEG0/KSEG1, since the physical address can't change underneath us.
+INLINE bool is_linkable_address(dword virtual_address) {
+    return is_unmapped_address(virtual_address);
+}
+
+// Returns true if the branch always goes to the same place, and writes the target to `target`.
+static bool branch_static_target(mips_instruction_t instr, dword branch_virtual_address, dword* target) {
     switch (instr.op) {
         case OPC_REGIMM: // REGIMM opcodes are only branches
         case OPC_BEQ:
@@ -132,37 +302,835 @@ bool branch_is_loop(mips_instruction_t instr, word block_length) {
         case OPC_BLEZ:
         case OPC_BLEZL:
         case OPC_BNE:
-        case OPC_BNEL: {
-            // offset is in number of instructions, not bytes
+        case OPC_BNEL:
+        case OPC_CP1: { // Only BC1x are branches
             shalf offset = instr.i.immediate;
-            offset = -offset;
+            sdword soffset = offset;
+            *target = branch_virtual_address + 4 + (soffset << 2);
+            return true;
+        }
+
+        case OPC_J:
+        case OPC_JAL:
+            *target = ((branch_virtual_address + 4) & 0xFFFFFFFFF0000000) | (instr.j.target << 2);
+            return true;
+
+        default: // JR, JALR
+            return false;
+    }
+}
+
+// Adds the next virtual address to the list of places a block can exit to, if it can be linked to.
+INLINE void add_exit(dword* exits, int* num_exits, dword virtual_address) {
+    if (is_linkable_address(virtual_address)) {
+        exits[(*num_exits)++] = virtual_address;
+    }
+}
+
+static void patch_link(dynarec_link_t* link, byte* destination) {
+    sword rel = (sword)(destination - link->jump_end);
+    memcpy(link->jump_end - sizeof(sword), &rel, sizeof(sword));
+}
+
+INLINE n64_dynarec_block_t* get_linkable_block(word physical_address) {
+    n64_dynarec_block_t* block_list = N64DYNAREC->blockcache[physical_address >> BLOCKCACHE_OUTER_SHIFT];
+    if (block_list == NULL) {
+        return NULL;
+    }
+    n64_dynarec_block_t* block = &block_list[(physical_address & (BLOCKCACHE_PAGE_SIZE - 1)) >> 2];
+    return block->body != NULL ? block : NULL;
+}
+
+static void add_link(word source_physical_address, byte* jump_end, dword target_virtual_address) {
+    dynarec_link_t* link = malloc(sizeof(dynarec_link_t));
+    if (link == NULL) {
+        logfatal("Failed to allocate a block link");
+    }
+    link->jump_end = jump_end;
+    link->unlinked = jump_end + *(sword*)(jump_end - sizeof(sword));
+    link->source = source_physical_address;
+    link->target = target_virtual_address & 0x1FFFFFFF;
+    link->source_invalidated = false;
+
+    word into_page = link->target >> BLOCKCACHE_OUTER_SHIFT;
+    word from_page = source_physical_address >> BLOCKCACHE_OUTER_SHIFT;
+    link->next_into_page = N64DYNAREC->links_into_page[into_page];
+    N64DYNAREC->links_into_page[into_page] = link;
+    link->next_from_page = N64DYNAREC->links_from_page[from_page];
+    N64DYNAREC->links_from_page[from_page] = link;
+
+    n64_dynarec_block_t* target = get_linkable_block(link->target);
+    if (target != NULL) {
+        patch_link(link, target->body);
+    }
+}
+
+// Points every pending link into the block at `physical_address` at it, now that it's been compiled.
+static void resolve_links_into(word physical_address, n64_dynarec_block_t* block) {
+    dynarec_link_t** link = &N64DYNAREC->links_into_page[physical_address >> BLOCKCACHE_OUTER_SHIFT];
+    while (*link != NULL) {
+        dynarec_link_t* current = *link;
+        if (current->source_invalidated) {
+            // Already removed from the from list when it was marked
+            *link = current->next_into_page;
+            free(current);
+        } else {
+            if (current->target == physical_address) {
+                patch_link(current, block->body);
+            }
+            link = &current->next_into_page;
+        }
+    }
+}
+
+INLINE void update_indirect_cache(dword virtual_address, n64_dynarec_block_t* block) {
+    if (is_linkable_address(virtual_address)) {
+        dynarec_indirect_entry_t* entry = &N64DYNAREC->indirect_cache[indirect_cache_index(virtual_address)];
+        entry->virtual_address = virtual_address;
+        entry->body = block->body;
+    }
+}
+
+INLINE bool indirect_entry_in_page(dynarec_indirect_entry_t* entry, word outer_index) {
+    // Only KSEG0/KSEG1 addresses are cached, so the physical address is easy to find
+    return entry->body != NULL && ((entry->virtual_address & 0x1FFFFFFF) >> BLOCKCACHE_OUTER_SHIFT) == outer_index;
+}
+
+// Forgets about any computed jump targets in the page.
+static void invalidate_indirect_targets(word outer_index) {
+    for (int i = 0; i < INDIRECT_CACHE_SIZE; i++) {
+        if (indirect_entry_in_page(&N64DYNAREC->indirect_cache[i], outer_index)) {
+            N64DYNAREC->indirect_cache[i].virtual_address = 0;
+            N64DYNAREC->indirect_cache[i].body = NULL;
+        }
+    }
+    for (int i = 0; i < RETURN_STACK_SIZE; i++) {
+        if (indirect_entry_in_page(&N64DYNAREC->return_stack[i], outer_index)) {
+            N64DYNAREC->return_stack[i].body = NULL;
+        }
+    }
+}
+
+// Unlinks everything jumping into the page, and forgets about the links jumping out of it.
+static void unlink_page(word outer_index) {
+    for (dynarec_link_t* link = N64DYNAREC->links_from_page[outer_index]; link != NULL; link = link->next_from_page) {
+        link->source_invalidated = true;
+    }
+    N64DYNAREC->links_from_page[outer_index] = NULL;
+
+    dynarec_link_t** link = &N64DYNAREC->links_into_page[outer_index];
+    while (*link != NULL) {
+        dynarec_link_t* current = *link;
+        // Always unlink, even if the source is gone. It might still be running.
+        patch_link(current, current->unlinked);
+        if (current->source_invalidated) {
+            *link = current->next_into_page;
+            free(current);
+        } else {
+            link = &current->next_into_page;
+        }
+    }
+}
+
+// Unlinks everything jumping into the block, and forgets about the links jumping out of it.
+static void unlink_block(word physical_address) {
+    word outer_index = physical_address >> BLOCKCACHE_OUTER_SHIFT;
+    dynarec_link_t** link = &N64DYNAREC->links_from_page[outer_index];
+    while (*link != NULL) {
+        dynarec_link_t* current = *link;
+        if (current->source == physical_address) {
+            current->source_invalidated = true;
+            *link = current->next_from_page;
+        } else {
+            link = &current->next_from_page;
+        }
+    }
+
+    link = &N64DYNAREC->links_into_page[outer_index];
+    while (*link != NULL) {
+        dynarec_link_t* current = *link;
+        if (current->target == physical_address) {
+            patch_link(current, current->unlinked);
+        }
+        if (current->source_invalidated) {
+            *link = current->next_into_page;
+            free(current);
+        } else {
+            link = &current->next_into_page;
+        }
+    }
+}
+
+// Forgets about a block that computed jumps might be going to.
+static void invalidate_indirect_target(void* body) {
+    for (int i = 0; i < INDIRECT_CACHE_SIZE; i++) {
+        if (N64DYNAREC->indirect_cache[i].body == body) {
+            N64DYNAREC->indirect_cache[i].virtual_address = 0;
+            N64DYNAREC->indirect_cache[i].body = NULL;
+        }
+    }
+    for (int i = 0; i < RETURN_STACK_SIZE; i++) {
+        if (N64DYNAREC->return_stack[i].body == body) {
+            N64DYNAREC->return_stack[i].body = NULL;
+        }
+    }
+}
+
+void reset_dynarec_links() {
+    memset(N64DYNAREC->indirect_cache, 0, sizeof(N64DYNAREC->indirect_cache));
+    memset(N64DYNAREC->return_stack, 0, sizeof(N64DYNAREC->return_stack));
+
+    // Every link is in exactly one into list, so that's enough to find them all.
+    for (int i = 0; i < BLOCKCACHE_OUTER_SIZE; i++) {
+        dynarec_link_t* link = N64DYNAREC->links_into_page[i];
+        while (link != NULL) {
+            dynarec_link_t* next = link->next_into_page;
+            free(link);
+            link = next;
+        }
+        N64DYNAREC->links_into_page[i] = NULL;
+        N64DYNAREC->links_from_page[i] = NULL;
+    }
+}
+
+// Whether the branch jumps back to the start of the block. Calls don't count, they're going somewhere else.
+static bool branch_is_loop(mips_instruction_t instr, dword branch_virtual_address, dword block_virtual_address) {
+    if (instr.op == OPC_JAL) {
+        return false;
+    }
+    dword target;
+    return branch_static_target(instr, branch_virtual_address, &target) && target == block_virtual_address;
+}
+
+// The register a branch writes its return address to, or 0 if it doesn't link.
+static int branch_link_reg(mips_instruction_t instr) {
+    switch (instr.op) {
+        case OPC_JAL:
+            return 31;
+        case OPC_REGIMM: // BLTZAL, BGEZAL
+            return instr.i.rt == RT_BLTZAL || instr.i.rt == RT_BGEZAL ? 31 : 0;
+        case OPC_SPCL: // JALR
+            return instr.r.funct == FUNCT_JALR ? instr.r.rd : 0;
+        default:
+            return 0;
+    }
+}
 
-            return offset == block_length;
+// Works out which guest registers an instruction reads and writes, from its format.
+static void instruction_gpr_usage(dynarec_block_instr_t* bi) {
+    mips_instruction_t instr = bi->instr;
+    word reads = 0;
+    word writes = 0;
+    bool exact = true;
+    switch (bi->ir->format) {
+        case FORMAT_NOP:
+            break;
+        case SHIFT_CONST:
+            reads = GPR_BIT(instr.r.rt);
+            writes = GPR_BIT(instr.r.rd);
+            break;
+        case I_TYPE:
+            reads = GPR_BIT(instr.i.rs);
+            writes = GPR_BIT(instr.i.rt);
+            break;
+        case R_TYPE:
+            reads = GPR_BIT(instr.r.rs) | GPR_BIT(instr.r.rt);
+            writes = GPR_BIT(instr.r.rd);
+            break;
+        case MF_MULTREG:
+            writes = GPR_BIT(instr.r.rd);
+            break;
+        case MT_MULTREG:
+            reads = GPR_BIT(instr.r.rs);
+            break;
+        case BRANCH_RS_RT:
+            reads = GPR_BIT(instr.i.rs) | GPR_BIT(instr.i.rt);
+            break;
+        case BRANCH_RS:
+            reads = GPR_BIT(instr.i.rs);
+            break;
+        case BRANCH_RS_LINK:
+            reads = GPR_BIT(instr.i.rs);
+            writes = GPR_BIT(branch_link_reg(instr));
+            break;
+        case J_TYPE:
+            writes = instr.op == OPC_JAL ? GPR_BIT(31) : 0;
+            break;
+        default:
+            // Handled by the interpreter. No MIPS instruction reads anything other than rs and rt, or writes anything
+            // other than rt, rd, or $ra for linking branches. Which of these it actually uses depends on the instruction.
+            reads = GPR_BIT(instr.r.rs) | GPR_BIT(instr.r.rt);
+            writes = GPR_BIT(instr.r.rt) | GPR_BIT(instr.r.rd) | GPR_BIT(31);
+            exact = false;
+            break;
+    }
+    bi->gpr_reads = reads;
+    bi->gpr_writes = writes;
+    bi->gpr_kills = exact ? writes & ~GPR_BIT(0) : 0;
+}
+
+static void decode_block_instr(dynarec_block_instr_t* bi, word raw, dword virtual_address, word physical_address) {
+    bi->instr.raw = raw;
+    bi->ir = instruction_ir(bi->instr, physical_address);
+    bi->virtual_address = virtual_address;
+    bi->physical_address = physical_address;
+    bi->trace_guard = false;
+    bi->code_write_check = false;
+    instruction_gpr_usage(bi);
+}
+
+// Whether the delay slot of a branch in the last word of a page is in the next physical page. Through the TLB it can be
+// anywhere, and blocks have to be physically contiguous: everything that tracks them (code masks, invalidation, the
+// hashes of worker compiled blocks) only knows a block's start and length.
+static bool delay_slot_is_contiguous(dword branch_virtual_address, word branch_physical_address) {
+    dword delay_slot_virtual_address = branch_virtual_address + 4;
+    if (is_unmapped_address(delay_slot_virtual_address)) {
+        return true;
+    }
+    // Only looking, not accessing, so don't leave a TLB error behind.
+    int tlb_error = N64CP0.tlb_error;
+    word delay_slot_physical_address;
+    bool mapped = resolve_virtual_address(delay_slot_virtual_address, BUS_LOAD, &delay_slot_physical_address);
+    N64CP0.tlb_error = tlb_error;
+    return mapped && delay_slot_physical_address == branch_physical_address + 4;
+}
+
+// Decodes the block starting at the given address and works out where it ends. Returns the number of instructions, or
+// 0 if the block is a branch whose delay slot isn't physically next to it, which has to be interpreted.
+static int scan_block(dword virtual_address, word physical_address) {
+    int num_instrs = 0;
+    int instructions_left_in_block = -1;
+    bool should_continue_block = true;
+
+    do {
+        dynarec_block_instr_t* bi = &block_instrs[num_instrs++];
+        decode_block_instr(bi, n64_read_physical_word(physical_address), virtual_address, physical_address);
+
+        word next_physical_address = physical_address + 4;
+
+        instructions_left_in_block--;
+        bool instr_ends_block;
+
+        switch (bi->ir->category) {
+            case NORMAL:
+                instr_ends_block = instructions_left_in_block == 0;
+                break;
+
+            case BRANCH:
+            case BRANCH_LIKELY:
+                if (instructions_left_in_block == 0) {
+                    // A branch in a delay slot. The block can't know where it goes next, see emit_block().
+                    instr_ends_block = true;
+                } else {
+                    instr_ends_block = false;
+                    instructions_left_in_block = 1; // emit delay slot
+                }
+                break;
+
+            case BLOCK_ENDER:
+            case TLB_WRITE:
+            case STORE:
+                instr_ends_block = true;
+                break;
+
+            default:
+                logfatal("Unknown dynarec instruction type");
+        }
+
+        bool page_boundary_ends_block = IS_PAGE_BOUNDARY(next_physical_address);
+        // If the first instruction in the new page is a delay slot, include it in the block anyway.
+        // The block is registered as code in both pages, so writes to the delay slot still invalidate it.
+        if (page_boundary_ends_block && instructions_left_in_block == 1) {
+            if (!delay_slot_is_contiguous(virtual_address, physical_address)) {
+                return num_instrs - 1; // End the block before the branch instead
+            }
+            page_boundary_ends_block = false;
+        }
+
+        if (instr_ends_block || page_boundary_ends_block) {
+#ifdef N64_LOG_COMPILATIONS
+            printf("Ending block. instr: %d pb: %d (0x%08X)\n", instr_ends_block, page_boundary_ends_block, next_physical_address);
+#endif
+            should_continue_block = false;
+        }
+
+        physical_address = next_physical_address;
+        virtual_address += 4;
+    } while (should_continue_block);
+
+    return num_instrs;
+}
+
+// Works out the physical address of a trace's successor, which is only possible if it's in the same page as the
+// trace's head or isn't mapped through the TLB.
+static bool trace_physical_address(dword virtual_address, dword head_virtual_address, word head_physical_address, word* physical_address) {
+    if ((virtual_address & ~(dword)(BLOCKCACHE_PAGE_SIZE - 1)) == (head_virtual_address & ~(dword)(BLOCKCACHE_PAGE_SIZE - 1))) {
+        *physical_address = (head_physical_address & ~(BLOCKCACHE_PAGE_SIZE - 1)) | (virtual_address & (BLOCKCACHE_PAGE_SIZE - 1));
+        return true;
+    }
+    if (is_unmapped_address(virtual_address)) {
+        *physical_address = virtual_address & 0x1FFFFFFF;
+        return true;
+    }
+    return false;
+}
+
+INLINE word block_run_count(word physical_address) {
+    return N64DYNAREC->block_counts[block_count_index(physical_address)];
+}
+
+// Picks where a trace goes after a branch, going by how often the blocks on either side of it have run. A way has to
+// be taken at least three times out of four to be followed. Likely branches can only be followed when taken, since
+// they leave the block when they aren't.
+static bool choose_trace_successor(dynarec_block_instr_t* branch, dword head_virtual_address, word head_physical_address, dword* next) {
+    dword taken;
+    if (!branch_static_target(branch->instr, branch->virtual_address, &taken)) {
+        return false; // JR, JALR
+    }
+    if (branch->instr.op == OPC_J || branch->instr.op == OPC_JAL) {
+        *next = taken;
+        return true;
+    }
+
+    dword fallthrough = branch->virtual_address + 8;
+    word taken_physical;
+    word fallthrough_physical;
+    if (!trace_physical_address(taken, head_virtual_address, head_physical_address, &taken_physical)
+        || !trace_physical_address(fallthrough, head_virtual_address, head_physical_address, &fallthrough_physical)) {
+        return false;
+    }
+    dword taken_runs = block_run_count(taken_physical);
+    dword fallthrough_runs = block_run_count(fallthrough_physical);
+    dword total = taken_runs + fallthrough_runs;
+    if (total == 0) {
+        return false;
+    }
+    if (taken_runs * 4 >= total * 3) {
+        *next = taken;
+        return true;
+    }
+    if (branch->ir->category == BRANCH && fallthrough_runs * 4 >= total * 3) {
+        *next = fallthrough;
+        return true;
+    }
+    return false;
+}
+
+// Decodes a trace for a hot block: the block, continued past stores and along the way its branches usually go. Stays
+// within the block's page, and never goes back to before the block's start, so it can be invalidated like one long
+// block. Returns the number of instructions, and how many instructions from the start the trace covers in extent.
+static int form_trace(dword virtual_address, word physical_address, int* extent) {
+    word visited[BLOCKCACHE_INNER_SIZE / 32];
+    memset(visited, 0, sizeof(visited));
+
+    int num_instrs = 0;
+    int num_segments = 0;
+    dword segment_virtual_address = virtual_address;
+    bool trace_continues = true;
+
+    while (trace_continues) {
+        trace_continues = false;
+        num_segments++;
+        word segment_physical_address;
+        if (!trace_physical_address(segment_virtual_address, virtual_address, physical_address, &segment_physical_address)) {
+            break; // The trace ends where it can't be followed
+        }
+        word segment_index = (segment_physical_address & (BLOCKCACHE_PAGE_SIZE - 1)) >> 2;
+        visited[segment_index >> 5] |= 1u << (segment_index & 31);
+
+        dword instr_virtual_address = segment_virtual_address;
+        word instr_physical_address = segment_physical_address;
+        int instructions_left_in_segment = -1;
+        bool should_continue_segment = true;
+        do {
+            dynarec_block_instr_t* bi = &block_instrs[num_instrs++];
+            decode_block_instr(bi, n64_read_physical_word(instr_physical_address), instr_virtual_address, instr_physical_address);
+            word next_physical_address = instr_physical_address + 4;
+            instructions_left_in_segment--;
+
+            bool delay_slot_done = instructions_left_in_segment == 0;
+            bool trace_ends = false;
+            switch (bi->ir->category) {
+                case NORMAL:
+                    break;
+                case STORE:
+                    // Blocks end here in case the store overwrites what comes next, the trace checks for that instead.
+                    bi->code_write_check = true;
+                    break;
+                case BRANCH:
+                case BRANCH_LIKELY:
+                    if (delay_slot_done) {
+                        trace_ends = true; // A branch in a delay slot, blocks end here too
+                    } else {
+                        instructions_left_in_segment = 1;
+                    }
+                    break;
+                case BLOCK_ENDER:
+                case TLB_WRITE:
+                    trace_ends = true;
+                    break;
+                default:
+                    logfatal("Unknown dynarec instruction type");
+            }
+
+            if (IS_PAGE_BOUNDARY(next_physical_address)) {
+                if (instructions_left_in_segment != 1) {
+                    trace_ends = true;
+                } else if (!delay_slot_is_contiguous(instr_virtual_address, instr_physical_address)) {
+                    // Like scan_block(), end before the branch. Only the head can start in the last word of the page,
+                    // and then there's no trace.
+                    num_instrs--;
+                    break;
+                }
+            }
+
+            if (delay_slot_done && !trace_ends && num_segments < TRACE_MAX_SEGMENTS) {
+                dynarec_block_instr_t* branch = &block_instrs[num_instrs - 2];
+                dword next;
+                word next_physical;
+                if (choose_trace_successor(branch, virtual_address, physical_address, &next)
+                    && trace_physical_address(next, virtual_address, physical_address, &next_physical)) {
+                    word next_index = (next_physical & (BLOCKCACHE_PAGE_SIZE - 1)) >> 2;
+                    bool same_page = (next_physical >> BLOCKCACHE_OUTER_SHIFT) == (physical_address >> BLOCKCACHE_OUTER_SHIFT);
+                    bool already_in_trace = (visited[next_index >> 5] & (1u << (next_index & 31))) != 0;
+                    // The next segment can run to the end of the page, plus a delay slot.
+                    bool fits = num_instrs + (BLOCKCACHE_INNER_SIZE - next_index) + 1 <= MAX_BLOCK_INSTRS;
+                    bool last_word = next_index == BLOCKCACHE_INNER_SIZE - 1;
+                    if (same_page && next_physical > physical_address && !already_in_trace && fits && !last_word) {
+                        branch->trace_guard = true;
+                        branch->trace_next = next;
+                        segment_virtual_address = next;
+                        trace_continues = true;
+                    }
+                }
+            }
+
+            if (delay_slot_done || trace_ends) {
+                should_continue_segment = false;
+            }
+            instr_physical_address = next_physical_address;
+            instr_virtual_address += 4;
+        } while (should_continue_segment);
+    }
+
+    if (num_instrs == 0) {
+        return 0;
+    }
+
+    // Nothing comes after the last instruction, so there's nothing for a store to overwrite.
+    block_instrs[num_instrs - 1].code_write_check = false;
+
+    *extent = 0;
+    for (int i = 0; i < num_instrs; i++) {
+        int instr_extent = (int)((block_instrs[i].physical_address - physical_address) >> 2) + 1;
+        if (instr_extent > *extent) {
+            *extent = instr_extent;
         }
+    }
+    return num_instrs;
+}
 
+INLINE bool is_memory_access(mips_instruction_t instr) {
+    switch (instr.op) {
+        case OPC_LB: case OPC_LBU: case OPC_LH: case OPC_LHU: case OPC_LW: case OPC_LWU: case OPC_LWL: case OPC_LWR:
+        case OPC_LD: case OPC_LDL: case OPC_LDR: case OPC_LL: case OPC_LLD:
+        case OPC_SB: case OPC_SH: case OPC_SW: case OPC_SWL: case OPC_SWR: case OPC_SD: case OPC_SDL: case OPC_SDR:
+        case OPC_LWC1: case OPC_LDC1: case OPC_SWC1: case OPC_SDC1:
+            return true;
         default:
             return false;
     }
 }
 
-void compile_new_block(n64_dynarec_block_t* block, dword virtual_address, word physical_address) {
-    mark_metric(METRIC_BLOCK_COMPILATION);
-    static dasm_State* d;
-    d = block_header();
+// Works out the value written by an instruction with all of its inputs known. Only covers the instructions commonly
+// used to build constants and addresses.
+static bool evaluate_constant(mips_instruction_t instr, dword* values, word known, int* dest, dword* result) {
+    sdword simm = (shalf)instr.i.immediate;
+    bool rs_known = known & GPR_BIT(instr.i.rs);
+    bool rt_known = known & GPR_BIT(instr.i.rt);
+    dword rs = values[instr.i.rs];
+    dword rt = values[instr.i.rt];
+
+    *dest = instr.i.rt;
+    switch (instr.op) {
+        case OPC_LUI:   *result = (sdword)(sword)((word)instr.i.immediate << 16); return true;
+        case OPC_ADDI: // Overflow isn't checked by the compiler either
+        case OPC_ADDIU: *result = (sdword)(sword)(rs + simm); return rs_known;
+        case OPC_DADDI:
+        case OPC_DADDIU: *result = rs + simm; return rs_known;
+        case OPC_ANDI:  *result = rs & instr.i.immediate; return rs_known;
+        case OPC_ORI:   *result = rs | instr.i.immediate; return rs_known;
+        case OPC_XORI:  *result = rs ^ instr.i.immediate; return rs_known;
+        case OPC_SPCL:
+            *dest = instr.r.rd;
+            switch (instr.r.funct) {
+                case FUNCT_SLL:  *result = (sdword)(sword)((word)rt << instr.r.sa); return rt_known;
+                case FUNCT_ADDU: *result = (sdword)(sword)(rs + rt); return rs_known && rt_known;
+                case FUNCT_DADDU: *result = rs + rt; return rs_known && rt_known;
+                case FUNCT_OR:   *result = rs | rt; return rs_known && rt_known;
+                default: return false;
+            }
+        default:
+            return false;
+    }
+}
+
+// Works out whether a branch will be taken, if its operands are known. Linking branches aren't folded.
+static bool evaluate_branch(mips_instruction_t instr, dword* values, word known, bool* taken) {
+    bool rs_known = known & GPR_BIT(instr.i.rs);
+    bool rt_known = known & GPR_BIT(instr.i.rt);
+    sdword rs = values[instr.i.rs];
+    sdword rt = values[instr.i.rt];
+    switch (instr.op) {
+        case OPC_BEQ: case OPC_BEQL: *taken = rs == rt; return rs_known && rt_known;
+        case OPC_BNE: case OPC_BNEL: *taken = rs != rt; return rs_known && rt_known;
+        case OPC_BLEZ: case OPC_BLEZL: *taken = rs <= 0; return rs_known;
+        case OPC_BGTZ: case OPC_BGTZL: *taken = rs > 0; return rs_known;
+        case OPC_REGIMM:
+            switch (instr.i.rt) {
+                case RT_BLTZ: case RT_BLTZL: *taken = rs < 0; return rs_known;
+                case RT_BGEZ: case RT_BGEZL: *taken = rs >= 0; return rs_known;
+                default: return false;
+            }
+        default:
+            return false;
+    }
+}
+
+// Forward pass over the block, tracking which guest registers hold values known at compile time.
+// Results that are known get loaded as immediates, memory accesses to known addresses get specialized, and branches
+// with known conditions get folded. Updates the register usage accordingly, so this needs to run before liveness.
+static void propagate_constants(int num_instrs) {
+    dword values[32] = {0};
+    word known = GPR_BIT(0);
+
+    for (int i = 0; i < num_instrs; i++) {
+        dynarec_block_instr_t* bi = &block_instrs[i];
+        mips_instruction_t instr = bi->instr;
+
+        bi->address_known = is_memory_access(instr) && (known & GPR_BIT(instr.i.rs));
+        bi->address = values[instr.i.rs] + (sdword)(shalf)instr.i.immediate;
+
+        // Not taken likely branches leave the block, only fold them if they're taken.
+        bi->branch_known = is_branch(bi->ir->category) && evaluate_branch(instr, values, known, &bi->branch_taken)
+                && (bi->ir->category == BRANCH || bi->branch_taken);
+        if (bi->branch_known) {
+            // Emitted inline instead of calling the interpreter, and doesn't link
+            bi->gpr_reads = 0;
+            bi->gpr_writes = 0;
+        }
+
+        int dest;
+        bool is_native = bi->ir->format == I_TYPE || bi->ir->format == SHIFT_CONST || bi->ir->format == R_TYPE;
+        bi->result_known = is_native && evaluate_constant(instr, values, known, &dest, &bi->result)
+                && dest != 0 && (bi->gpr_writes & GPR_BIT(dest));
+        if (bi->result_known) {
+            bi->result_reg = dest;
+            bi->gpr_reads = 0; // Loaded as an immediate instead
+        }
+
+        known &= ~bi->gpr_writes;
+        if (bi->result_known) {
+            known |= GPR_BIT(dest);
+            values[dest] = bi->result;
+        }
+        known |= GPR_BIT(0);
+    }
+}
+
+// Backwards pass over the block, working out which guest registers are still needed after each instruction.
+static void compute_liveness(int num_instrs) {
+    word live = ALL_GPRS; // Nothing is known about what runs after the block
+    for (int i = num_instrs - 1; i >= 0; i--) {
+        dynarec_block_instr_t* bi = &block_instrs[i];
+        // Exceptions and not taken likely branches leave the block straight after the instruction, and so do traces
+        // after a store or the delay slot of a branch they continue past.
+        bool delay_slot_of_guard = i > 0 && block_instrs[i - 1].trace_guard;
+        if (bi->ir->exception_possible || bi->ir->category == BRANCH_LIKELY || bi->code_write_check || delay_slot_of_guard) {
+            live = ALL_GPRS;
+        }
+        bi->gpr_live_after = live;
+        live = (live & ~bi->gpr_kills) | bi->gpr_reads;
+    }
+}
+
+static int missing_block_handler();
+static int queued_block_handler();
+static void invalidate_block(word physical_address, n64_dynarec_block_t* block);
+
+// Finds the block list for a page, creating it if it doesn't exist yet.
+static n64_dynarec_block_t* get_block_list(word outer_index) {
+    n64_dynarec_block_t* block_list = N64DYNAREC->blockcache[outer_index];
+    if (unlikely(block_list == NULL)) {
+#ifdef N64_LOG_COMPILATIONS
+        printf("Need a new block list for page 0x%05X\n", outer_index);
+#endif
+        block_list = dynarec_alloc_block_list();
+        for (int i = 0; i < BLOCKCACHE_INNER_SIZE; i++) {
+            block_list[i].run = missing_block_handler;
+        }
+        N64DYNAREC->blockcache[outer_index] = block_list;
+    }
+    return block_list;
+}
+
+// Finds the code mask for a page, creating it if it doesn't exist yet.
+static word* get_code_mask(word outer_index) {
+    word* code_mask = N64DYNAREC->code_mask[outer_index];
+    if (unlikely(code_mask == NULL)) {
+        code_mask = dynarec_alloc_code_mask();
+        N64DYNAREC->code_mask[outer_index] = code_mask;
+    }
+    return code_mask;
+}
+
+INLINE word code_mask_bit(word physical_address) {
+    return (physical_address & (BLOCKCACHE_PAGE_SIZE - 1)) >> CODE_MASK_SHIFT;
+}
+
+INLINE bool is_code(word physical_address) {
+    word* code_mask = N64DYNAREC->code_mask[physical_address >> BLOCKCACHE_OUTER_SHIFT];
+    word bit = code_mask_bit(physical_address);
+    return code_mask != NULL && (code_mask[bit >> 5] & (1u << (bit & 31))) != 0;
+}
+
+static void mark_code(word block_physical_address, int num_instrs) {
+    for (int i = 0; i < num_instrs; i++) {
+        word physical_address = block_physical_address + (i << 2);
+        word bit = code_mask_bit(physical_address);
+        N64DYNAREC->code_mask[physical_address >> BLOCKCACHE_OUTER_SHIFT][bit >> 5] |= 1u << (bit & 31);
+    }
+}
+
+// Puts a block's code in the block cache. Blocks are always physically contiguous, see delay_slot_is_contiguous().
+static n64_dynarec_block_t* place_block(word physical_address, int num_instrs, void* code, void* body) {
+    // Placing the code can evict a code cache region, so the block has to be looked up afterwards.
+    // A delay slot can be in the next page, which needs a code mask as well.
+    get_code_mask(physical_address >> BLOCKCACHE_OUTER_SHIFT);
+    get_code_mask((physical_address + ((num_instrs - 1) << 2)) >> BLOCKCACHE_OUTER_SHIFT);
+    n64_dynarec_block_t* block_list = get_block_list(physical_address >> BLOCKCACHE_OUTER_SHIFT);
+    n64_dynarec_block_t* block = &block_list[(physical_address & (BLOCKCACHE_PAGE_SIZE - 1)) >> 2];
+
+    block->run = code;
+    block->body = body;
+    block->length = num_instrs;
+    block->no_trace = false;
+    mark_code(physical_address, num_instrs);
+    return block;
+}
+
+static void translation_cache_key(dynarec_cache_key_t* key, dword virtual_address, word physical_address, int num_instrs) {
+    dword hash = DYNAREC_CACHE_HASH_INIT;
+    for (int i = 0; i < num_instrs; i++) {
+        hash = dynarec_cache_hash(hash, &block_instrs[i].instr.raw, sizeof(word));
+    }
+    key->virtual_address = virtual_address;
+    key->guest_hash = hash;
+    key->physical_address = physical_address;
+    key->num_instrs = num_instrs;
+    key->flags = dynarec_cache_flags();
+}
+
+// Copies a block into the code cache from the translation cache, instead of compiling it.
+static n64_dynarec_block_t* install_cached_block(dynarec_cache_entry_t* entry, dword virtual_address, word physical_address) {
+    word code_size = entry->block.code_size;
+    byte* code = dynarec_bumpalloc(code_size);
+    memcpy(code, cached_code(entry), code_size);
+
+    dynarec_reloc_t* relocs = cached_relocs(entry);
+    for (int i = 0; i < entry->block.num_relocs; i++) {
+        byte* immediate = code + relocs[i].offset - sizeof(uintptr_t);
+        uintptr_t address;
+        memcpy(&address, immediate, sizeof(uintptr_t));
+        address += dynarec_reloc_base_address(relocs[i].base);
+        memcpy(immediate, &address, sizeof(uintptr_t));
+    }
+
+    dynarec_cached_site_t* sites = cached_sites(entry);
+    for (int i = 0; i < entry->block.num_sites; i++) {
+        fastmem_register_site((uintptr_t)code + sites[i].patch, (uintptr_t)code + sites[i].access, (uintptr_t)code + sites[i].slow);
+    }
+
+    static dynarec_exception_site_t exception_sites[MAX_EXCEPTION_SITES];
+    dynarec_cached_exception_site_t* cached_exceptions = cached_exception_sites(entry);
+    for (int i = 0; i < entry->block.num_exception_sites; i++) {
+        exception_sites[i].return_address = (uintptr_t)code + cached_exceptions[i].return_offset;
+        exception_sites[i].pc = cached_exceptions[i].pc;
+    }
+    dynarec_register_exception_sites(exception_sites, entry->block.num_exception_sites);
+
+    n64_dynarec_block_t* block = place_block(physical_address, entry->block.key.num_instrs, code, code + entry->block.body_offset);
+
+    dynarec_cached_link_t* links = cached_links(entry);
+    for (int i = 0; i < entry->block.num_links; i++) {
+        add_link(physical_address, code + links[i].jump_end, links[i].target);
+    }
+    resolve_links_into(physical_address, block);
+    update_indirect_cache(virtual_address, block);
+    return block;
+}
+
+// Copies a block that was just encoded, before any of its links are patched, into a translation cache entry.
+static dynarec_cache_entry_t* make_translation_cache_entry(dasm_State** d, dynarec_cache_key_t* key, byte* code, size_t code_size,
+                                                           int* link_labels, dword* link_targets, int num_links) {
+    static _Thread_local dynarec_reloc_t relocs[MAX_HOST_ADDRESSES];
+    static _Thread_local dynarec_cached_site_t sites[MAX_FASTMEM_SITES];
+    static _Thread_local dynarec_cached_exception_site_t exception_sites[MAX_EXCEPTION_SITES];
+    dynarec_cached_link_t links[3];
+
+    dynarec_cached_block_t block;
+    block.key = *key;
+    block.code_size = code_size;
+    block.body_offset = dasm_getpclabel(d, BLOCK_BODY_LABEL);
+    block.num_links = num_links;
+    for (int i = 0; i < num_links; i++) {
+        links[i].target = link_targets[i];
+        links[i].jump_end = dasm_getpclabel(d, link_labels[i]);
+        links[i].unused = 0;
+    }
+    block.num_relocs = get_host_address_relocs(d, relocs);
+    block.num_sites = get_fastmem_site_offsets(d, sites);
+    block.num_exception_sites = get_exception_site_offsets(d, exception_sites);
+    return dynarec_cache_new_entry(&block, code, links, relocs, sites, exception_sites);
+}
+
+// After a branch in the delay slot of another branch, which is always the last instruction in the block. The
+// instruction after it depends on where both of them went, so the interpreter runs it (and anything after it that's
+// also in a delay slot), and the block exits to wherever the PC ends up.
+static void emit_branch_in_delay_slot(dasm_State** Dst) {
+    flush_all(Dst);
+    run_pending_delay_slots(Dst);
+}
+
+INLINE bool is_sign_extended(dword virtual_address) {
+    return (dword)(sdword)(sword)virtual_address == virtual_address;
+}
+
+// Emits the code for the block in block_instrs, ready to be linked and encoded. Fills in the block's patchable exits.
+// Blocks count how often they're run, traces formed by form_trace() don't, since they won't be recompiled again.
+static dasm_State* emit_block(int num_instrs, bool fr, bool trace, dword* link_targets, int* link_labels, int* num_links_out) {
+    dasm_State* d = block_header(true);
     dasm_State** Dst = &d;
+    set_compiled_fr(fr);
 
-    memset(guest_reg_loaded, 0, sizeof(guest_reg_loaded));
-    memset(host_reg_used, 0, sizeof(host_reg_used));
+    if (!trace && is_sign_extended(block_instrs[0].virtual_address)) {
+        count_block_run(Dst, block_instrs[0].virtual_address, block_instrs[0].physical_address);
+    }
+    bool checks_code_writes = false;
+    for (int i = 0; i < num_instrs; i++) {
+        checks_code_writes |= block_instrs[i].code_write_check;
+    }
+    if (checks_code_writes) {
+        snapshot_code_writes(Dst);
+    }
 
-    num_available_host_regs = num_valid_host_regs;
+    propagate_constants(num_instrs);
+    compute_liveness(num_instrs);
+    reset_host_regs();
 
-    bool should_continue_block = true;
     int block_length = 0;
     int block_extra_cycles = 0;
 
-
-    int instructions_left_in_block = -1;
-
     dynarec_instruction_category_t prev_instr_category = NORMAL;
 
     bool branch_in_block = false;
@@ -170,199 +1138,499 @@ void compile_new_block(n64_dynarec_block_t* block, dword virtual_address, word p
     bool block_is_stable = true;
     bool block_is_loop = false;
 
-    do {
-        mips_instruction_t instr;
-        instr.raw = n64_read_physical_word(physical_address);
+    int num_links = 0;
 
-        block_is_stable &= instruction_stable(instr);
+    bool block_exit_known = true;
+    mips_instruction_t last_branch = {.raw = 0};
+    dynarec_instruction_category_t last_branch_category = NORMAL;
+    dword last_branch_virtual_address = 0;
+    dynarec_block_instr_t* last_branch_instr = NULL;
 
-        word next_physical_address = physical_address + 4;
-        dword next_virtual_address = virtual_address + 4;
+    for (int i = 0; i < num_instrs; i++) {
+        dynarec_block_instr_t* bi = &block_instrs[i];
+        mips_instruction_t instr = bi->instr;
+        dynarec_ir_t* ir = bi->ir;
+        word physical_address = bi->physical_address;
+        dword virtual_address = bi->virtual_address;
+        current_instr = i;
+        pinned_host_regs = 0;
 
-        instructions_left_in_block--;
-        bool instr_ends_block;
+        bool known_rdram_access = bi->address_known && is_direct_rdram_address(bi->address);
+        bool known_poll_access = bi->address_known && is_unmapped_address(bi->address) && is_idle_poll_address(bi->address & 0x1FFFFFFF);
+        block_is_stable &= instruction_stable(instr, known_rdram_access, known_poll_access);
+
+        dword next_virtual_address = virtual_address + 4;
 
         word extra_cycles = 0;
-        dynarec_ir_t* ir = instruction_ir(instr, physical_address);
-        if (ir->exception_possible) {
-            // save prev_pc
-            // TODO will no longer need this when we emit code to check the exceptions
-            flush_prev_pc(Dst, virtual_address);
-        }
-        if (is_branch(ir->category)) {
+        set_exception_pc(ir->exception_possible, virtual_address);
+        // A branch in a delay slot runs with the PC wherever the first branch sent it, so that's left alone.
+        bool branch_in_delay_slot = is_branch(ir->category) && is_branch(prev_instr_category);
+        if (is_branch(ir->category) && !branch_in_delay_slot) {
             flush_pc(Dst, next_virtual_address);
             flush_next_pc(Dst, next_virtual_address + 4);
             clear_branch_flag(Dst);
         }
-        switch (ir->format) {
-            case CALL_INTERPRETER:
-                flush_all(Dst);
-                break;
-            case FORMAT_NOP:break; // Shouldn't touch any registers, so no need to do anything
-            case SHIFT_CONST:
-                load_reg_2(Dst, &arg_host_registers[0], instr.r.rt, &dest_host_register, instr.r.rd);
-                break;
-            case I_TYPE:
-                load_reg_2(Dst, &arg_host_registers[0], instr.i.rs, &dest_host_register, instr.i.rt);
-                break;
-            case R_TYPE:
-                load_reg_3(Dst, &arg_host_registers[0], instr.r.rt, &arg_host_registers[1], instr.r.rs, &dest_host_register, instr.r.rd);
-                break;
-            case J_TYPE:
-                logfatal("Allocate regs for J_TYPE");
-                break;
-            case MF_MULTREG:
-                load_reg_1(Dst, &dest_host_register, instr.r.rd);
-                break;
-            case MT_MULTREG:
-                load_reg_1(Dst, &arg_host_registers[0], instr.r.rs);
-                break;
-        }
-        if (ir->exception_possible) {
-            set_prev_branch_flag(Dst, prev_instr_category == BRANCH || prev_instr_category == BRANCH_LIKELY);
+        if (bi->branch_known) {
+            emit_known_branch(Dst, instr, bi->branch_taken);
+        } else if (bi->result_known) {
+            load_host_register_constant(Dst, def_reg(Dst, bi->result_reg), bi->result);
+        } else {
+            switch (ir->format) {
+                case CALL_INTERPRETER:
+                    prepare_interpreter_call(Dst, bi);
+                    break;
+                case FORMAT_NOP:break; // Shouldn't touch any registers, so no need to do anything
+                case SHIFT_CONST:
+                    arg_host_registers[0] = use_operand(Dst, instr.r.rt, ir->width);
+                    dest_host_register = def_reg(Dst, instr.r.rd);
+                    break;
+                case I_TYPE:
+                    arg_host_registers[0] = use_operand(Dst, instr.i.rs, ir->width);
+                    dest_host_register = def_reg(Dst, instr.i.rt);
+                    break;
+                case R_TYPE:
+                    arg_host_registers[0] = use_operand(Dst, instr.r.rt, ir->width);
+                    arg_host_registers[1] = use_operand(Dst, instr.r.rs, ir->width);
+                    dest_host_register = def_reg(Dst, instr.r.rd);
+                    break;
+                case J_TYPE:
+                    if (instr.op == OPC_JAL) {
+                        dest_host_register = def_reg(Dst, 31);
+                    }
+                    break;
+                case MF_MULTREG:
+                    dest_host_register = def_reg(Dst, instr.r.rd);
+                    break;
+                case MT_MULTREG:
+                    arg_host_registers[0] = use_reg(Dst, instr.r.rs);
+                    break;
+                case BRANCH_RS_RT:
+                    arg_host_registers[0] = use_reg(Dst, instr.i.rs);
+                    arg_host_registers[1] = use_reg(Dst, instr.i.rt);
+                    break;
+                case BRANCH_RS:
+                    arg_host_registers[0] = use_reg(Dst, instr.i.rs);
+                    break;
+                case BRANCH_RS_LINK: {
+                    arg_host_registers[0] = use_reg(Dst, instr.i.rs);
+                    int link = branch_link_reg(instr);
+                    dest_host_register = link != 0 ? def_reg(Dst, link) : -1;
+                    break;
+                }
+                case VECTOR:
+                    logfatal("RSP vector instruction format in a CPU block");
+            }
+            if (ir->exception_possible) {
+                set_prev_branch_flag(Dst, prev_instr_category == BRANCH || prev_instr_category == BRANCH_LIKELY);
+            }
+            set_known_memory_address(bi->address_known, bi->address);
+            ir->compiler(Dst, instr, physical_address, arg_host_registers, dest_host_register, &extra_cycles);
+            if (ir->format == CALL_INTERPRETER) {
+                finish_interpreter_call(bi);
+            } else if (ir->width != WIDTH_64) {
+                mark_unextended(ir->format == I_TYPE ? instr.i.rt : instr.r.rd);
+            }
         }
-        ir->compiler(Dst, instr, physical_address, arg_host_registers, dest_host_register, &extra_cycles);
         block_length++;
         block_extra_cycles += extra_cycles;
         if (ir->exception_possible) {
-            check_exception(Dst, block_length + block_extra_cycles);
+            check_exception(Dst, block_length + block_extra_cycles, emit_exit_writeback);
         }
 #ifdef N64_DEBUG_MODE
         else {
             check_exception_sanity(Dst, block_length + block_extra_cycles);
         }
 #endif
+        if (bi->code_write_check) {
+            bool in_delay_slot = prev_instr_category == BRANCH || prev_instr_category == BRANCH_LIKELY;
+            check_code_writes(Dst, block_length + block_extra_cycles, in_delay_slot, next_virtual_address, emit_exit_writeback);
+        }
 
         switch (ir->category) {
             case NORMAL:
-                instr_ends_block = instructions_left_in_block == 0;
                 break;
             case BRANCH:
                 branch_in_block = true;
-                advance_pc(Dst);
-                if (prev_instr_category == BRANCH || prev_instr_category == BRANCH_LIKELY) {
-                    // Check if the previous branch was taken.
-
-                    // If the last branch wasn't taken, we can treat this the same as if the previous instruction wasn't a branch
-                    // just set the N64CPU.last_branch_taken to N64CPU.branch_taken and execute the next instruction.
-
-                    // emit:
-                    // if (!N64CPU.last_branch_taken) N64CPU.last_branch_taken = N64CPU.branch_taken;
-                    logfatal("Branch in a branch delay slot");
-                } else {
-                    // If the last instruction wasn't a branch, no special behavior is needed. Just set up some state in case the next one is.
-                    // emit:
-                    // N64CPU.last_branch_taken = N64CPU.branch_taken;
-                    //logfatal("unimp");
+                if (branch_in_delay_slot) {
+                    emit_branch_in_delay_slot(Dst);
+                    block_exit_known = false;
+                    block_is_loop = false;
+                    block_extra_cycles++;
+                    break;
                 }
+                advance_pc(Dst);
 
-                instr_ends_block = false;
-                instructions_left_in_block = 1; // emit delay slot
-
-                block_is_loop = branch_is_loop(instr, block_length);
+                // Traces aren't contiguous, so the branch offset doesn't say anything about looping back to the start.
+                block_is_loop = !trace && branch_is_loop(instr, virtual_address, block_instrs[0].virtual_address);
+                last_branch = instr;
+                last_branch_category = BRANCH;
+                last_branch_virtual_address = virtual_address;
+                last_branch_instr = bi;
                 break;
 
             case BRANCH_LIKELY:
                 branch_in_block = true;
-                // If the previous instruction was a branch:
-                if (prev_instr_category == BRANCH || prev_instr_category == BRANCH_LIKELY) {
-                    logfatal("Branch in a branch likely delay slot");
+                if (branch_in_delay_slot) {
+                    emit_branch_in_delay_slot(Dst);
+                    block_exit_known = false;
+                    block_is_loop = false;
+                    block_extra_cycles++;
+                    break;
+                } else if (bi->branch_known) {
+                    // Only folded when it's taken, so it can't leave the block early
+                    advance_pc(Dst);
                 } else {
-                    // TODO: only need to flush all if we exit the block early
-                    flush_all(Dst);
-                    post_branch_likely(Dst, block_length);
+                    // Not taken skips the delay slot
+                    int num_not_taken = 0;
+                    add_exit(&link_targets[num_links], &num_not_taken, virtual_address + 8);
+                    post_branch_likely(Dst, block_length, &link_targets[num_links], &link_labels[num_links], num_not_taken, emit_exit_writeback);
+                    num_links += num_not_taken;
                 }
 
-                instr_ends_block = false;
-                instructions_left_in_block = 1; // emit delay slot
-
-                block_is_loop = branch_is_loop(instr, block_length);
+                block_is_loop = !trace && branch_is_loop(instr, virtual_address, block_instrs[0].virtual_address);
+                last_branch = instr;
+                last_branch_category = BRANCH_LIKELY;
+                last_branch_virtual_address = virtual_address;
+                last_branch_instr = bi;
                 break;
 
             case BLOCK_ENDER:
                 branch_in_block = true;
-                instr_ends_block = true;
+                block_exit_known = false; // ERET
                 break;
 
             case TLB_WRITE:
             case STORE:
-                instr_ends_block = true;
                 break;
 
             default:
                 logfatal("Unknown dynarec instruction type");
         }
 
-        bool page_boundary_ends_block = IS_PAGE_BOUNDARY(next_physical_address);
-        // !!!!!!!!!!!!!!! WARNING !!!!!!!!!!!!!!!
-        // If the first instruction in the new page is a delay slot, INCLUDE IT IN THE BLOCK ANYWAY.
-        // This DOES BREAK a corner case!
-        // If the game overwrites the delay slot but does not overwrite the branch or anything in the other page,
-        // THIS BLOCK WILL NOT GET MARKED DIRTY.
-        // I highly doubt any games do it, but THIS NEEDS TO GET FIXED AT SOME POINT
-        // !!!!!!!!!!!!!!! WARNING !!!!!!!!!!!!!!!
-        if (instructions_left_in_block == 1) { page_boundary_ends_block = false; } // FIXME, TODO, BAD, EVIL, etc
-
-        if (instr_ends_block || page_boundary_ends_block) {
-#ifdef N64_LOG_COMPILATIONS
-            printf("Ending block. instr: %d pb: %d (0x%08X)\n", instr_ends_block, page_boundary_ends_block, next_physical_address);
-#endif
-            if (!branch_in_block) {
-                flush_pc(Dst, next_virtual_address);
-                flush_next_pc(Dst, next_virtual_address + 4);
+        if (i > 0 && block_instrs[i - 1].trace_guard) {
+            // The delay slot of a branch the trace continues past. Likely branches have already left if they weren't
+            // taken, and jumps always go the right way.
+            dynarec_block_instr_t* guard = &block_instrs[i - 1];
+            dword taken_target;
+            bool is_jump = guard->instr.op == OPC_J || guard->instr.op == OPC_JAL;
+            if (guard->ir->category == BRANCH && !is_jump && branch_static_target(guard->instr, guard->virtual_address, &taken_target)) {
+                dword other = guard->trace_next == taken_target ? guard->virtual_address + 8 : taken_target;
+                int num_other = 0;
+                add_exit(&link_targets[num_links], &num_other, other);
+                trace_guard(Dst, block_length + block_extra_cycles, guard->trace_next, &link_targets[num_links], &link_labels[num_links], num_other, emit_exit_writeback);
+                num_links += num_other;
             }
-            should_continue_block = false;
+            branch_in_block = false;
+        }
+
+        drop_dead_regs();
+
+        if (i == num_instrs - 1 && !branch_in_block) {
+            flush_pc(Dst, next_virtual_address);
+            flush_next_pc(Dst, next_virtual_address + 4);
         }
 
-        physical_address = next_physical_address;
-        virtual_address = next_virtual_address;
         prev_instr_category = ir->category;
-    } while (should_continue_block);
-    if (block_is_stable && block_is_loop) {
-        block_extra_cycles += 64;
     }
+    dword virtual_address = block_instrs[num_instrs - 1].virtual_address + 4;
     flush_all(Dst);
-    end_block(Dst, block_length + block_extra_cycles);
-    void* compiled = link_and_encode(&d);
+    // A stable loop will do exactly the same thing again next time, until an interrupt or an event changes something
+    // it reads. So if it's about to go round again, skip straight to the next event.
+    if (block_is_stable && block_is_loop && is_sign_extended(block_instrs[0].virtual_address)) {
+        skip_idle_loop(Dst, block_length + block_extra_cycles, block_instrs[0].virtual_address);
+    }
+
+    int num_exits = 0;
+    dword* exits = &link_targets[num_links];
+    bool exit_is_indirect = false;
+    bool exit_is_return = false;
+    if (!branch_in_block) {
+        add_exit(exits, &num_exits, virtual_address);
+    } else if (!block_exit_known) {
+        exit_is_indirect = true; // ERET
+    } else {
+        dword target;
+        if (branch_static_target(last_branch, last_branch_virtual_address, &target)) {
+            bool known = last_branch_instr->branch_known;
+            if (!known || last_branch_instr->branch_taken) {
+                add_exit(exits, &num_exits, target);
+            }
+            // Likely branches already left the block if not taken, and jumps are always taken.
+            bool can_fall_through = last_branch_category == BRANCH && last_branch.op != OPC_J && last_branch.op != OPC_JAL;
+            if (can_fall_through && (!known || !last_branch_instr->branch_taken)) {
+                add_exit(exits, &num_exits, last_branch_virtual_address + 8);
+            }
+        } else {
+            exit_is_indirect = true; // JR, JALR
+            exit_is_return = last_branch.r.funct == FUNCT_JR && last_branch.r.rs == 31;
+        }
+
+        bool is_call = last_branch.op == OPC_JAL || (last_branch.op == OPC_SPCL && last_branch.r.funct == FUNCT_JALR);
+        if (is_call && is_linkable_address(last_branch_virtual_address + 8)) {
+            push_return_address(Dst, last_branch_virtual_address + 8);
+        }
+    }
+
+    if (num_exits > 0) {
+        end_block_linked(Dst, block_length + block_extra_cycles, exits, &link_labels[num_links], num_exits);
+        num_links += num_exits;
+    } else if (exit_is_indirect) {
+        end_block_indirect(Dst, block_length + block_extra_cycles, exit_is_return);
+    } else {
+        end_block(Dst, block_length + block_extra_cycles);
+    }
+    *num_links_out = num_links;
+    return d;
+}
+
+// Returns NULL if the block can't be compiled, see scan_block().
+n64_dynarec_block_t* compile_new_block(dword virtual_address, word physical_address) {
+    int num_instrs = scan_block(virtual_address, physical_address);
+    if (num_instrs == 0) {
+        return NULL;
+    }
+
+    dynarec_cache_key_t key;
+    if (dynarec_cache_enabled()) {
+        translation_cache_key(&key, virtual_address, physical_address, num_instrs);
+        dynarec_cache_entry_t* entry = dynarec_cache_find(&key);
+        if (entry != NULL) {
+            mark_metric(METRIC_BLOCK_CACHE_INSTALL);
+            return install_cached_block(entry, virtual_address, physical_address);
+        }
+    }
+
+    mark_metric(METRIC_BLOCK_COMPILATION);
+    // Patchable jumps out of the block: at most one for a branch likely not being taken, and two at the end.
+    dword link_targets[3];
+    int link_labels[3];
+    int num_links;
+    dasm_State* d = emit_block(num_instrs, N64CPU.cp0.status.fr, false, link_targets, link_labels, &num_links);
+
+    size_t code_size;
+    void* compiled = link_and_encode(&d, &code_size);
+    if (dynarec_cache_enabled()) {
+        dynarec_cache_insert(make_translation_cache_entry(&d, &key, compiled, code_size, link_labels, link_targets, num_links));
+    }
+
+    n64_dynarec_block_t* block = place_block(physical_address, num_instrs, compiled,
+                                             get_dynamic_label_address(&d, compiled, BLOCK_BODY_LABEL));
+
+    for (int i = 0; i < num_links; i++) {
+        add_link(physical_address, get_dynamic_label_address(&d, compiled, link_labels[i]), link_targets[i]);
+    }
+    resolve_links_into(physical_address, block);
+    update_indirect_cache(virtual_address, block);
+
+    dasm_free(&d);
+    return block;
+}
+
+// Recompiles a block that got hot as a trace, which replaces it in the block cache. Traces aren't saved to the
+// translation cache, the block gets hot again and is recompiled on the next run instead.
+static void promote_block(dword virtual_address, word physical_address) {
+    n64_dynarec_block_t* block = get_linkable_block(physical_address);
+    if (block == NULL || block->no_trace) {
+        return; // Invalidated since it asked, or already tried
+    }
+    int extent;
+    int num_instrs = form_trace(virtual_address, physical_address, &extent);
+    if (num_instrs <= block->length) {
+        block->no_trace = true; // No longer than the block itself
+        return;
+    }
+
+    mark_metric(METRIC_TRACE_COMPILATION);
+    dword link_targets[MAX_TRACE_LINKS];
+    int link_labels[MAX_TRACE_LINKS];
+    int num_links;
+    dasm_State* d = emit_block(num_instrs, N64CPU.cp0.status.fr, true, link_targets, link_labels, &num_links);
+
+    size_t code_size;
+    void* compiled = link_and_encode(&d, &code_size);
+
+    // Placing the code can evict the block, otherwise links into it need to be moved over to the trace.
+    block = get_linkable_block(physical_address);
+    if (block != NULL) {
+        invalidate_block(physical_address, block);
+    }
+    block = place_block(physical_address, extent, compiled, get_dynamic_label_address(&d, compiled, BLOCK_BODY_LABEL));
+
+    for (int i = 0; i < num_links; i++) {
+        add_link(physical_address, get_dynamic_label_address(&d, compiled, link_labels[i]), link_targets[i]);
+    }
+    resolve_links_into(physical_address, block);
+    update_indirect_cache(virtual_address, block);
+
     dasm_free(&d);
+}
+
+// Runs on the dynarec worker. Only touches the job and this thread's compiler state, the emulation thread puts the
+// result in the code cache once it's done.
+dynarec_cache_entry_t* compile_block_job(dynarec_compile_job_t* job) {
+    int num_instrs = job->key.num_instrs;
+    for (int i = 0; i < num_instrs; i++) {
+        decode_block_instr(&block_instrs[i], job->instrs[i], job->key.virtual_address + (i << 2), job->key.physical_address + (i << 2));
+    }
+
+    dword link_targets[3];
+    int link_labels[3];
+    int num_links;
+    dasm_State* d = emit_block(num_instrs, (job->key.flags & DYNAREC_CACHE_FR) != 0, false, link_targets, link_labels, &num_links);
 
-    block->run = compiled;
+    // Blocks are position independent until they're installed, so they can be encoded anywhere.
+    size_t code_size;
+    dasm_link(&d, &code_size);
+    byte* code = malloc(code_size);
+    if (code == NULL) {
+        logfatal("Failed to allocate %ld bytes to compile a block into", code_size);
+    }
+    dasm_encode(&d, code);
+    dynarec_cache_entry_t* entry = make_translation_cache_entry(&d, &job->key, code, code_size, link_labels, link_targets, num_links);
+    free(code);
+    dasm_free(&d);
+    return entry;
+}
+
+INLINE n64_dynarec_block_t* find_block(word physical_address) {
+    n64_dynarec_block_t* block_list = get_block_list(physical_address >> BLOCKCACHE_OUTER_SHIFT);
+    return &block_list[(physical_address & (BLOCKCACHE_PAGE_SIZE - 1)) >> 2];
+}
+
+// Runs at least num_instrs instructions in the interpreter, without stopping between a branch and its delay slot.
+static int interpret_block(int num_instrs) {
+    int taken = 0;
+    do {
+        r4300i_step_instruction();
+        taken++;
+    } while (taken < num_instrs || N64CPU.branch);
+    return taken;
+}
+
+// Hands a block to the dynarec worker, and interprets it until the worker is done with it.
+static int queue_block(dword virtual_address, word physical_address) {
+    int num_instrs = scan_block(virtual_address, physical_address);
+    if (num_instrs == 0) {
+        return interpret_block(1);
+    }
+
+    dynarec_cache_key_t key;
+    translation_cache_key(&key, virtual_address, physical_address, num_instrs);
+    if (dynarec_cache_enabled()) {
+        dynarec_cache_entry_t* entry = dynarec_cache_find(&key);
+        if (entry != NULL) {
+            mark_metric(METRIC_BLOCK_CACHE_INSTALL);
+            return install_cached_block(entry, virtual_address, physical_address)->run(&N64CPU);
+        }
+    }
+
+    dynarec_compile_job_t* job = malloc(sizeof(dynarec_compile_job_t));
+    if (job == NULL) {
+        logfatal("Failed to allocate a dynarec compile job");
+    }
+    job->key = key;
+    for (int i = 0; i < num_instrs; i++) {
+        job->instrs[i] = block_instrs[i].instr.raw;
+    }
+    if (dynarec_worker_submit(job)) {
+        n64_dynarec_block_t* block = find_block(physical_address);
+        block->run = queued_block_handler;
+        block->length = num_instrs;
+    } else {
+        free(job); // The worker is busy, try again next time the block is reached.
+    }
+    return interpret_block(num_instrs);
+}
+
+// Puts the blocks the worker has finished in the code cache. Anything that was written to since it was queued is
+// thrown away, and queued again the next time it's reached.
+static void publish_compiled_blocks() {
+    dynarec_compile_job_t* job;
+    while ((job = dynarec_worker_take_finished()) != NULL) {
+        dynarec_cache_entry_t* entry = job->result;
+        dynarec_cache_key_t* key = &entry->block.key;
+        n64_dynarec_block_t* block = find_block(key->physical_address);
+
+        dword hash = DYNAREC_CACHE_HASH_INIT;
+        for (int i = 0; i < key->num_instrs; i++) {
+            word instr = n64_read_physical_word(key->physical_address + (i << 2));
+            hash = dynarec_cache_hash(hash, &instr, sizeof(word));
+        }
+
+        if (block->body != NULL || hash != key->guest_hash) {
+            if (block->run == queued_block_handler) {
+                block->run = missing_block_handler;
+                block->length = 0;
+            }
+            dynarec_cache_free_entry(entry);
+        } else {
+            mark_metric(METRIC_BLOCK_COMPILATION);
+            install_cached_block(entry, key->virtual_address, key->physical_address);
+            if (dynarec_cache_enabled()) {
+                dynarec_cache_insert(entry);
+            } else {
+                dynarec_cache_free_entry(entry);
+            }
+        }
+        free(job);
+    }
 }
 
 
 static int missing_block_handler() {
     word physical = resolve_virtual_address_or_die(N64CPU.pc, BUS_LOAD);
-    word outer_index = physical >> BLOCKCACHE_OUTER_SHIFT;
-    n64_dynarec_block_t* block_list = n64sys.dynarec->blockcache[outer_index];
-    word inner_index = (physical & (BLOCKCACHE_PAGE_SIZE - 1)) >> 2;
-
-    n64_dynarec_block_t* block = &block_list[inner_index];
 
 #ifdef N64_LOG_COMPILATIONS
     printf("Compilin' new block at 0x%08X / 0x%08X\n", N64CPU.pc, physical);
 #endif
 
-    compile_new_block(block, N64CPU.pc, physical);
+    if (dynarec_worker_running()) {
+        return queue_block(N64CPU.pc, physical);
+    }
+
+    n64_dynarec_block_t* block = compile_new_block(N64CPU.pc, physical);
+    if (block == NULL) {
+        return interpret_block(1);
+    }
 
     return block->run(&N64CPU);
 }
 
-int n64_dynarec_step() {
+static int queued_block_handler() {
     word physical = resolve_virtual_address_or_die(N64CPU.pc, BUS_LOAD);
-    word outer_index = physical >> BLOCKCACHE_OUTER_SHIFT;
-    n64_dynarec_block_t* block_list = N64DYNAREC->blockcache[outer_index];
-    word inner_index = (physical & (BLOCKCACHE_PAGE_SIZE - 1)) >> 2;
+    return interpret_block(find_block(physical)->length);
+}
 
-    if (unlikely(block_list == NULL)) {
-#ifdef N64_LOG_COMPILATIONS
-        printf("Need a new block list for page 0x%05X (address 0x%08X virtual 0x%08X)\n", outer_index, physical, N64CPU.pc);
-#endif
-        block_list = dynarec_bumpalloc_zero(BLOCKCACHE_INNER_SIZE * sizeof(n64_dynarec_block_t));
-        for (int i = 0; i < BLOCKCACHE_INNER_SIZE; i++) {
-            block_list[i].run = missing_block_handler;
-        }
-        N64DYNAREC->blockcache[outer_index] = block_list;
+static void flush_pc_translations(n64_dynarec_t* dynarec) {
+    for (int i = 0; i < PC_TRANSLATION_CACHE_SIZE; i++) {
+        dynarec->pc_translations[i].virtual_page = PC_TRANSLATION_INVALID;
     }
+}
+
+INLINE word resolve_pc(dword pc) {
+    dword virtual_page = pc & ~(dword)(PC_TRANSLATION_PAGE_SIZE - 1);
+    dynarec_pc_translation_t* translation = &N64DYNAREC->pc_translations[pc_translation_index(pc)];
+    if (likely(translation->virtual_page == virtual_page && translation->generation == N64CP0.translation_generation)) {
+        return translation->physical_page | (pc & (PC_TRANSLATION_PAGE_SIZE - 1));
+    }
+    word physical = resolve_virtual_address_or_die(pc, BUS_LOAD);
+    translation->virtual_page = virtual_page;
+    translation->physical_page = physical & ~(PC_TRANSLATION_PAGE_SIZE - 1);
+    translation->generation = N64CP0.translation_generation;
+    return physical;
+}
+
+int n64_dynarec_step(int cycle_budget) {
+    if (dynarec_worker_running()) {
+        publish_compiled_blocks();
+    }
+    N64DYNAREC->cycle_budget = cycle_budget / CYCLES_PER_INSTR;
+    set_metric(METRIC_CODECACHE_BYTES_USED, N64DYNAREC->codecache_used);
+    set_metric(METRIC_DYNAREC_METADATA_BYTES, dynarec_metadata_bytes());
+    word physical = resolve_pc(N64CPU.pc);
+    word outer_index = physical >> BLOCKCACHE_OUTER_SHIFT;
+    n64_dynarec_block_t* block_list = get_block_list(outer_index);
+    word inner_index = (physical & (BLOCKCACHE_PAGE_SIZE - 1)) >> 2;
 
     n64_dynarec_block_t* block = &block_list[inner_index];
 
@@ -370,8 +1638,14 @@ int n64_dynarec_step() {
     static long total_blocks_run;
     logdebug("Running block at 0x%016lX - block run #%ld - block FP: 0x%016lX", N64CPU.pc, ++total_blocks_run, (uintptr_t)block->run);
 #endif
+    if (block->body != NULL) {
+        // Computed jumps that missed the indirect cache end up here, so remember where they were going.
+        update_indirect_cache(N64CPU.pc, block);
+    }
+
     N64CPU.exception = false;
     int taken = block->run(&N64CPU);
+    N64DYNAREC->exception_frame = NULL;
 #ifdef N64_LOG_JIT_SYNC_POINTS
     printf("JITSYNC %d %08X ", taken, N64CPU.pc);
     for (int i = 0; i < 32; i++) {
@@ -384,6 +1658,11 @@ int n64_dynarec_step() {
 #endif
     logdebug("Done running block - took %d cycles - pc is now 0x%016lX", taken, N64CPU.pc);
 
+    if (unlikely(N64DYNAREC->hot_block.pending)) {
+        N64DYNAREC->hot_block.pending = false;
+        promote_block(N64DYNAREC->hot_block.virtual_address, N64DYNAREC->hot_block.physical_address);
+    }
+
     return taken * CYCLES_PER_INSTR;
 }
 
@@ -395,12 +1674,14 @@ n64_dynarec_t* n64_dynarec_init(byte* codecache, size_t codecache_size) {
 
     dynarec->codecache_size = codecache_size;
     dynarec->codecache_used = 0;
+    dynarec->codecache_region_size = codecache_size / CODECACHE_REGIONS;
 
     for (int i = 0; i < BLOCKCACHE_OUTER_SIZE; i++) {
         dynarec->blockcache[i] = NULL;
     }
 
     dynarec->codecache = codecache;
+    flush_pc_translations(dynarec);
 
     num_valid_host_regs = 32;
     fill_valid_host_regs(valid_host_regs, &num_valid_host_regs);
@@ -408,13 +1689,135 @@ n64_dynarec_t* n64_dynarec_init(byte* codecache, size_t codecache_size) {
     return dynarec;
 }
 
+static void invalidate_block(word physical_address, n64_dynarec_block_t* block) {
+    void* body = block->body;
+    block->run = missing_block_handler;
+    block->body = NULL;
+    block->length = 0;
+    block->no_trace = false;
+    unlink_block(physical_address);
+    invalidate_indirect_target(body);
+}
+
+// Invalidates the blocks in the previous page whose delay slot is the first instruction of this one.
+static void invalidate_blocks_crossing_into(word outer_index) {
+    if (outer_index == 0 || N64DYNAREC->blockcache[outer_index - 1] == NULL) {
+        return;
+    }
+    n64_dynarec_block_t* block_list = N64DYNAREC->blockcache[outer_index - 1];
+    word page_address = (outer_index - 1) << BLOCKCACHE_OUTER_SHIFT;
+    for (int i = 0; i < BLOCKCACHE_INNER_SIZE; i++) {
+        if (block_list[i].body != NULL && i + block_list[i].length > BLOCKCACHE_INNER_SIZE) {
+            invalidate_block(page_address + (i << 2), &block_list[i]);
+        }
+    }
+}
+
+// Invalidates every block that overlaps the granule containing the address.
+static void invalidate_blocks_overlapping(word physical_address) {
+    word outer_index = physical_address >> BLOCKCACHE_OUTER_SHIFT;
+    word page_address = outer_index << BLOCKCACHE_OUTER_SHIFT;
+    int first_instr = ((physical_address & (BLOCKCACHE_PAGE_SIZE - 1)) & ~(CODE_MASK_GRANULE - 1)) >> 2;
+    int end_instr = first_instr + (CODE_MASK_GRANULE >> 2);
+
+    n64_dynarec_block_t* block_list = N64DYNAREC->blockcache[outer_index];
+    if (block_list != NULL) {
+        // Any block starting before the end of the granule might reach into it.
+        for (int i = 0; i < end_instr; i++) {
+            if (block_list[i].body != NULL && i + block_list[i].length > first_instr) {
+                invalidate_block(page_address + (i << 2), &block_list[i]);
+            }
+        }
+    }
+    if (first_instr == 0) {
+        invalidate_blocks_crossing_into(outer_index);
+    }
+}
+
+// Called for every write that could touch code. Writes that don't overlap a compiled block are ignored, so stack and
+// data in the same page as code don't cause any recompilation.
+void invalidate_dynarec_code(word physical_address) {
+    if (is_code(physical_address)) {
+        N64DYNAREC->code_writes++;
+        invalidate_blocks_overlapping(physical_address);
+    }
+}
+
+// Throws away every block in the page, along with any that run into it.
 void invalidate_dynarec_page(word physical_address) {
     word outer_index = physical_address >> BLOCKCACHE_OUTER_SHIFT;
+    N64DYNAREC->code_writes++;
+    // If there's no code in the page, nothing can be linked into or out of it either.
+    if (N64DYNAREC->blockcache[outer_index] != NULL) {
+        unlink_page(outer_index);
+        invalidate_indirect_targets(outer_index);
+    }
+    if (N64DYNAREC->code_mask[outer_index] != NULL) {
+        invalidate_blocks_crossing_into(outer_index);
+    }
+    dynarec_free_block_list(N64DYNAREC->blockcache[outer_index]);
+    dynarec_free_code_mask(N64DYNAREC->code_mask[outer_index]);
     N64DYNAREC->blockcache[outer_index] = NULL;
+    N64DYNAREC->code_mask[outer_index] = NULL;
+}
+
+// Frees the links that jump out of blocks that no longer exist, so they're never patched again.
+static void free_dead_links(word outer_index) {
+    dynarec_link_t** link = &N64DYNAREC->links_into_page[outer_index];
+    while (*link != NULL) {
+        dynarec_link_t* current = *link;
+        if (current->source_invalidated) {
+            *link = current->next_into_page;
+            free(current);
+        } else {
+            link = &current->next_into_page;
+        }
+    }
+}
+
+// Throws away every block whose code lives in a region of the code cache, so it can be reused.
+void evict_dynarec_region(int region) {
+    byte* start = N64DYNAREC->codecache + region * N64DYNAREC->codecache_region_size;
+    byte* end = start + N64DYNAREC->codecache_region_used[region];
+
+    for (word outer_index = 0; outer_index < BLOCKCACHE_OUTER_SIZE; outer_index++) {
+        n64_dynarec_block_t* block_list = N64DYNAREC->blockcache[outer_index];
+        if (block_list == NULL) {
+            continue;
+        }
+        for (int i = 0; i < BLOCKCACHE_INNER_SIZE; i++) {
+            byte* code = (byte*)block_list[i].run;
+            if (block_list[i].body != NULL && code >= start && code < end) {
+                invalidate_block((outer_index << BLOCKCACHE_OUTER_SHIFT) + (i << 2), &block_list[i]);
+            }
+        }
+    }
+
+    // Dead links still point into the region, and patching them would now write over new code.
+    for (word outer_index = 0; outer_index < BLOCKCACHE_OUTER_SIZE; outer_index++) {
+        free_dead_links(outer_index);
+    }
+    fastmem_clear_sites_between((uintptr_t)start, (uintptr_t)end);
+    dynarec_clear_exception_sites_between((uintptr_t)start, (uintptr_t)end);
+
+    N64DYNAREC->codecache_used -= N64DYNAREC->codecache_region_used[region];
+    N64DYNAREC->codecache_region_used[region] = 0;
+    N64DYNAREC->codecache_evictions++;
+    mark_metric(METRIC_CODECACHE_EVICTION);
 }
 
 void invalidate_dynarec_all_pages(n64_dynarec_t* dynarec) {
+    dynarec->code_writes++;
+    memset(dynarec->indirect_cache, 0, sizeof(dynarec->indirect_cache));
+    memset(dynarec->return_stack, 0, sizeof(dynarec->return_stack));
+    flush_pc_translations(dynarec);
     for (int i = 0; i < BLOCKCACHE_OUTER_SIZE; i++) {
+        if (dynarec->blockcache[i] != NULL) {
+            unlink_page(i);
+        }
+        dynarec_free_block_list(dynarec->blockcache[i]);
+        dynarec_free_code_mask(dynarec->code_mask[i]);
         dynarec->blockcache[i] = NULL;
+        dynarec->code_mask[i] = NULL;
     }
 }
\ No newline at end of file
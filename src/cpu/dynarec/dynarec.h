@@ -10,6 +10,17 @@
 #define BLOCKCACHE_OUTER_SIZE (0x80000000 >> BLOCKCACHE_OUTER_SHIFT)
 // word aligned instructions
 #define BLOCKCACHE_INNER_SIZE (BLOCKCACHE_PAGE_SIZE >> 2)
+// A block can't be longer than a page plus a delay slot
+#define MAX_BLOCK_INSTRS (BLOCKCACHE_INNER_SIZE + 1)
+
+// The code cache is split into regions that are filled one after the other. Once they're all full, the oldest one is
+// evicted to make room for new code, instead of throwing everything away.
+#define CODECACHE_REGIONS 8
+
+// Compiled code is tracked in 8 byte granules, so an aligned store of any size only ever touches one.
+#define CODE_MASK_SHIFT 3
+#define CODE_MASK_GRANULE (1 << CODE_MASK_SHIFT)
+#define CODE_MASK_WORDS ((BLOCKCACHE_PAGE_SIZE >> CODE_MASK_SHIFT) / 32)
 
 typedef enum dynarec_instruction_category {
     NORMAL,
@@ -32,33 +43,162 @@ typedef enum instruction_format {
     R_TYPE,
     J_TYPE,
     MF_MULTREG,
-    MT_MULTREG
+    MT_MULTREG,
+    BRANCH_RS_RT,
+    BRANCH_RS,
+    BRANCH_RS_LINK, // Links into $ra, or rd for JALR
+    VECTOR // RSP vector unit instruction, compiled to use the XMM registers rsp_dynarec.c caches vector state in
 } instruction_format_t;
 
+// How much of its host registers an instruction's compiler looks at. 32 bit results are left with the upper half
+// undefined, and the register allocator sign extends them only once something needs the whole register.
+typedef enum value_width {
+    WIDTH_64,        // Reads its operands and writes its result as full 64 bit values
+    WIDTH_32_RESULT, // Reads full 64 bit operands, only the low 32 bits of the result are valid
+    WIDTH_32         // Only reads the low 32 bits of its operands, only the low 32 bits of the result are valid
+} value_width_t;
+
 typedef void(*mipsinstr_compiler_t)(dasm_State**, mips_instruction_t, word, int*, int, word*);
 
 typedef struct dynarec_ir {
     dynarec_instruction_category_t category;
     instruction_format_t format;
     bool exception_possible;
+    value_width_t width;
+    half vu_state; // VECTOR only, the RSP_VU_STATE() slots it uses
     mipsinstr_compiler_t compiler;
 } dynarec_ir_t;
 
+// KSEG0 and KSEG1 are mapped directly to physical memory, without going through the TLB.
+INLINE bool is_unmapped_address(dword virtual_address) {
+    sdword address = virtual_address;
+    return address >= (sword)SVREGION_KSEG0 && address < (sword)SVREGION_KSSEG;
+}
+
+// Accesses to these addresses can go straight to RDRAM, as long as the CPU is in kernel mode.
+INLINE bool is_direct_rdram_address(dword virtual_address) {
+    return is_unmapped_address(virtual_address) && (virtual_address & 0x1FFFFFFF) < N64_RDRAM_SIZE;
+}
+
 typedef struct n64_dynarec_block {
     int (*run)(r4300i_t* cpu);
+    // Just past the prologue, linked blocks jump straight here.
+    void* body;
+    // Number of instructions, a block can run one past the end of its page for a delay slot.
+    word length;
+    // Its trace was no longer than it, so it isn't promoted again until it's recompiled.
+    bool no_trace;
 } n64_dynarec_block_t;
 
+// A patchable jump at the end of a block that goes directly to the next block once it's compiled.
+typedef struct dynarec_link {
+    byte* jump_end; // Just past the jump's rel32
+    byte* unlinked; // Where the jump goes when the next block isn't available
+    word source; // Physical address of the block containing the jump
+    word target; // Physical address of the next block
+    bool source_invalidated; // The block containing the jump is gone, this link can be freed
+    struct dynarec_link* next_into_page;
+    struct dynarec_link* next_from_page;
+} dynarec_link_t;
+
+// Computed jumps (JR, JALR, ERET) look up their target here before going back to the dispatcher.
+// Indexed by the target's virtual address, only holds KSEG0/KSEG1 addresses, just like block links.
+#define INDIRECT_CACHE_SIZE 4096
+// Predicts where JR $ra is going, pushed by JAL/JALR.
+#define RETURN_STACK_SIZE 16
+
+typedef struct dynarec_indirect_entry {
+    dword virtual_address;
+    void* body; // NULL if unknown
+} dynarec_indirect_entry_t;
+
+_Static_assert(sizeof(dynarec_indirect_entry_t) == 16, "Generated code expects indirect cache entries to be 16 bytes");
+
+INLINE word indirect_cache_index(dword virtual_address) {
+    return (virtual_address >> 2) & (INDIRECT_CACHE_SIZE - 1);
+}
+
+// Every block counts how many times it's run, and asks to be recompiled as a trace once it's hot. Counts are indexed by
+// physical address, blocks that share a count just get hot sooner.
+#define BLOCK_COUNTS_SIZE 0x10000
+#define TIER_UP_THRESHOLD 1024 // Power of 2
+// How many times a trace can continue past a branch.
+#define TRACE_MAX_SEGMENTS 16
+
+INLINE word block_count_index(word physical_address) {
+    return (physical_address >> 2) & (BLOCK_COUNTS_SIZE - 1);
+}
+
+// Virtual pages the dispatcher has run code from recently, so it doesn't need a full address translation (and a TLB scan
+// for mapped code) before every block. Direct mapped, and only valid while the CP0 translation generation they were
+// filled under is current.
+#define PC_TRANSLATION_CACHE_SIZE 256 // Power of 2
+#define PC_TRANSLATION_PAGE_SIZE 0x1000 // The smallest TLB page
+#define PC_TRANSLATION_INVALID 1 // Never page aligned, so never matches
+
+typedef struct dynarec_pc_translation {
+    dword virtual_page;
+    word physical_page;
+    word generation;
+} dynarec_pc_translation_t;
+
+INLINE word pc_translation_index(dword virtual_address) {
+    return (virtual_address / PC_TRANSLATION_PAGE_SIZE) & (PC_TRANSLATION_CACHE_SIZE - 1);
+}
+
+// Written by a block when it hits TIER_UP_THRESHOLD, picked up by the dispatcher once the block returns.
+typedef struct dynarec_hot_block {
+    dword virtual_address;
+    word physical_address;
+    bool pending;
+} dynarec_hot_block_t;
+
 typedef struct n64_dynarec {
     byte* codecache;
     dword codecache_size;
-    dword codecache_used;
+    dword codecache_used; // Across all regions
+
+    dword codecache_region_size;
+    int codecache_region; // Being allocated from
+    dword codecache_region_used[CODECACHE_REGIONS];
+    word codecache_evictions; // Bumped every time a region is evicted
 
     n64_dynarec_block_t* blockcache[BLOCKCACHE_OUTER_SIZE];
+    // Which granules of each page are covered by a compiled block, one bit each. NULL if the page has no code at all.
+    word* code_mask[BLOCKCACHE_OUTER_SIZE];
+
+    // Links, by the page of the block they jump to and by the page of the block they jump from.
+    dynarec_link_t* links_into_page[BLOCKCACHE_OUTER_SIZE];
+    dynarec_link_t* links_from_page[BLOCKCACHE_OUTER_SIZE];
+
+    dynarec_indirect_entry_t indirect_cache[INDIRECT_CACHE_SIZE];
+    dynarec_indirect_entry_t return_stack[RETURN_STACK_SIZE];
+    word return_stack_top; // Always masked to RETURN_STACK_SIZE, the entry below it is the most recent push
+
+    dynarec_pc_translation_t pc_translations[PC_TRANSLATION_CACHE_SIZE];
+
+    // Linked blocks stop jumping into each other and return to the dispatcher once they've run this many cycles.
+    int cycle_budget;
+
+    word block_counts[BLOCK_COUNTS_SIZE];
+    dynarec_hot_block_t hot_block;
+    // Bumped whenever a write hits compiled code. Traces continue past stores, and check this hasn't changed since
+    // they were entered, in case the store overwrote the rest of the trace.
+    word code_writes;
+    word trace_code_writes;
+    // The stack pointer of the compiled block that's running, just after its prologue, NULL outside of compiled code.
+    // Exceptions raised by the interpreter handlers it calls find their guest PC through the return address below it.
+    byte* exception_frame;
 } n64_dynarec_t;
 
-int n64_dynarec_step();
+int n64_dynarec_step(int cycle_budget);
 n64_dynarec_t* n64_dynarec_init(byte* codecache, size_t codecache_size);
 void invalidate_dynarec_page(word physical_address);
+void invalidate_dynarec_code(word physical_address);
 void invalidate_dynarec_all_pages();
+void reset_dynarec_links();
+void evict_dynarec_region(int region);
+// The PC of the instruction in compiled code that's calling the interpreter, if it's one that can raise an exception.
+bool dynarec_exception_pc(dword* pc);
 
 #endif //N64_DYNAREC_H
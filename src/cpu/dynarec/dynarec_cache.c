@@ -0,0 +1,292 @@
+#include "dynarec_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <log.h>
+#include <system/n64system.h>
+#include <mem/n64bus.h>
+#include <cpu/mips_instructions.h>
+#include "dynarec.h"
+#include "asm_emitter.h"
+#include "fastmem.h"
+
+#define DYNAREC_CACHE_SUFFIX ".jitcache"
+#define DYNAREC_CACHE_MAGIC "N64JITC"
+#define DYNAREC_CACHE_VERSION 5 // Bump whenever the generated code changes
+#define DYNAREC_CACHE_BUCKETS 4096
+// Stop adding blocks past this, the file is read in one go on startup.
+#define DYNAREC_CACHE_MAX_BYTES (64 << 20)
+
+typedef struct dynarec_cache_header {
+    char magic[8];
+    word version;
+    word rom_crc1;
+    word rom_crc2;
+    word num_entries;
+    dword build; // See build_fingerprint()
+} dynarec_cache_header_t;
+
+static bool enabled = false;
+static bool dirty = false;
+static char cache_path[PATH_MAX]; // Empty if there's no ROM
+static word rom_crc1;
+static word rom_crc2;
+
+static dynarec_cache_entry_t* buckets[DYNAREC_CACHE_BUCKETS];
+static word num_entries = 0;
+static size_t bytes_used = 0;
+
+// Cached code has the addresses of functions and globals in it, so it's only valid for the exact build that wrote it.
+// This covers the emitter's templates, the layout of the structures the code accesses, and where a few functions in
+// different parts of the emulator ended up relative to its globals.
+static dword build_fingerprint() {
+    uintptr_t image = dynarec_reloc_base_address(RELOC_IMAGE);
+    dword layout[] = {
+            emitter_fingerprint(),
+            sizeof(r4300i_t),
+            sizeof(n64_dynarec_t),
+            (uintptr_t)&N64CPU - image,
+            (uintptr_t)invalidate_dynarec_code - image,
+            (uintptr_t)n64_read_physical_word - image,
+            (uintptr_t)mips_lb - image,
+    };
+    return dynarec_cache_hash(DYNAREC_CACHE_HASH_INIT, layout, sizeof(layout));
+}
+
+INLINE word bucket_index(word physical_address) {
+    return (physical_address >> 2) & (DYNAREC_CACHE_BUCKETS - 1);
+}
+
+INLINE bool keys_equal(dynarec_cache_key_t* a, dynarec_cache_key_t* b) {
+    return a->virtual_address == b->virtual_address
+        && a->guest_hash == b->guest_hash
+        && a->physical_address == b->physical_address
+        && a->num_instrs == b->num_instrs
+        && a->flags == b->flags;
+}
+
+static void insert_entry(dynarec_cache_entry_t* entry) {
+    word index = bucket_index(entry->block.key.physical_address);
+    entry->next = buckets[index];
+    buckets[index] = entry;
+    num_entries++;
+    bytes_used += sizeof(dynarec_cached_block_t) + cached_data_size(&entry->block);
+}
+
+static void clear_entries() {
+    for (int i = 0; i < DYNAREC_CACHE_BUCKETS; i++) {
+        dynarec_cache_entry_t* entry = buckets[i];
+        while (entry != NULL) {
+            dynarec_cache_entry_t* next = entry->next;
+            dynarec_cache_free_entry(entry);
+            entry = next;
+        }
+        buckets[i] = NULL;
+    }
+    num_entries = 0;
+    bytes_used = 0;
+    dirty = false;
+}
+
+static void load() {
+    FILE* f = fopen(cache_path, "rb");
+    if (f == NULL) {
+        return; // First run of this ROM
+    }
+
+    dynarec_cache_header_t header;
+    if (fread(&header, sizeof(header), 1, f) != 1
+        || memcmp(header.magic, DYNAREC_CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != DYNAREC_CACHE_VERSION) {
+        logwarn("%s isn't a translation cache this version understands, ignoring it", cache_path);
+        fclose(f);
+        return;
+    }
+    if (header.rom_crc1 != rom_crc1 || header.rom_crc2 != rom_crc2) {
+        logwarn("%s is for a different ROM, ignoring it", cache_path);
+        fclose(f);
+        return;
+    }
+    if (header.build != build_fingerprint()) {
+        logalways("%s was written by a different build, starting a new translation cache", cache_path);
+        fclose(f);
+        return;
+    }
+
+    for (word i = 0; i < header.num_entries; i++) {
+        dynarec_cache_entry_t* entry = malloc(sizeof(dynarec_cache_entry_t));
+        if (entry == NULL) {
+            logfatal("Failed to allocate a translation cache entry");
+        }
+        if (fread(&entry->block, sizeof(entry->block), 1, f) != 1) {
+            free(entry);
+            logwarn("%s is truncated, only loaded %d blocks", cache_path, i);
+            break;
+        }
+        size_t data_size = cached_data_size(&entry->block);
+        entry->data = malloc(data_size);
+        if (entry->data == NULL) {
+            logfatal("Failed to allocate %ld bytes for a translation cache entry", data_size);
+        }
+        if (fread(entry->data, data_size, 1, f) != 1) {
+            free(entry->data);
+            free(entry);
+            logwarn("%s is truncated, only loaded %d blocks", cache_path, i);
+            break;
+        }
+        insert_entry(entry);
+    }
+    fclose(f);
+    logalways("Loaded %d blocks from %s", num_entries, cache_path);
+}
+
+bool dynarec_cache_enabled() {
+    return enabled;
+}
+
+void dynarec_cache_enable() {
+    enabled = true;
+    if (n64sys.mem.rom.rom != NULL) {
+        dynarec_cache_open(n64sys.rom_path);
+    }
+}
+
+void dynarec_cache_open(const char* rom_path) {
+    if (!enabled) {
+        return;
+    }
+    dynarec_cache_save();
+    clear_entries();
+
+    if (strlen(rom_path) + strlen(DYNAREC_CACHE_SUFFIX) >= PATH_MAX) {
+        logwarn("Path too long, not using a translation cache for %s", rom_path);
+        cache_path[0] = '\0';
+        return;
+    }
+    strcpy(cache_path, rom_path);
+    strcat(cache_path, DYNAREC_CACHE_SUFFIX);
+    rom_crc1 = n64sys.mem.rom.header.crc1;
+    rom_crc2 = n64sys.mem.rom.header.crc2;
+    load();
+}
+
+void dynarec_cache_save() {
+    if (!enabled || !dirty || cache_path[0] == '\0') {
+        return;
+    }
+    FILE* f = fopen(cache_path, "wb");
+    if (f == NULL) {
+        logwarn("Failed to open %s to save the translation cache", cache_path);
+        return;
+    }
+
+    dynarec_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DYNAREC_CACHE_MAGIC, sizeof(header.magic));
+    header.version = DYNAREC_CACHE_VERSION;
+    header.rom_crc1 = rom_crc1;
+    header.rom_crc2 = rom_crc2;
+    header.num_entries = num_entries;
+    header.build = build_fingerprint();
+    fwrite(&header, sizeof(header), 1, f);
+
+    for (int i = 0; i < DYNAREC_CACHE_BUCKETS; i++) {
+        for (dynarec_cache_entry_t* entry = buckets[i]; entry != NULL; entry = entry->next) {
+            fwrite(&entry->block, sizeof(entry->block), 1, f);
+            fwrite(entry->data, cached_data_size(&entry->block), 1, f);
+        }
+    }
+    fclose(f);
+    dirty = false;
+    logalways("Saved %d blocks to %s", num_entries, cache_path);
+}
+
+word dynarec_cache_flags() {
+    word flags = 0;
+    if (N64CPU.cp0.status.fr) {
+        flags |= DYNAREC_CACHE_FR;
+    }
+    if (fastmem_enabled()) {
+        flags |= DYNAREC_CACHE_FASTMEM;
+    }
+    return flags;
+}
+
+dynarec_cache_entry_t* dynarec_cache_find(dynarec_cache_key_t* key) {
+    for (dynarec_cache_entry_t* entry = buckets[bucket_index(key->physical_address)]; entry != NULL; entry = entry->next) {
+        if (keys_equal(&entry->block.key, key)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+dynarec_cache_entry_t* dynarec_cache_new_entry(dynarec_cached_block_t* block, byte* code, dynarec_cached_link_t* links,
+                                               dynarec_reloc_t* relocs, dynarec_cached_site_t* sites,
+                                               dynarec_cached_exception_site_t* exception_sites) {
+    dynarec_cache_entry_t* entry = malloc(sizeof(dynarec_cache_entry_t));
+    if (entry == NULL) {
+        logfatal("Failed to allocate a translation cache entry");
+    }
+    memset(entry, 0, sizeof(dynarec_cache_entry_t)); // No uninitialized padding in the file
+    entry->block.key.virtual_address = block->key.virtual_address;
+    entry->block.key.guest_hash = block->key.guest_hash;
+    entry->block.key.physical_address = block->key.physical_address;
+    entry->block.key.num_instrs = block->key.num_instrs;
+    entry->block.key.flags = block->key.flags;
+    entry->block.code_size = block->code_size;
+    entry->block.body_offset = block->body_offset;
+    entry->block.num_links = block->num_links;
+    entry->block.num_relocs = block->num_relocs;
+    entry->block.num_sites = block->num_sites;
+    entry->block.num_exception_sites = block->num_exception_sites;
+
+    size_t data_size = cached_data_size(block);
+    entry->data = calloc(1, data_size);
+    if (entry->data == NULL) {
+        logfatal("Failed to allocate %ld bytes for a translation cache entry", data_size);
+    }
+    memcpy(cached_code(entry), code, block->code_size);
+    memcpy(cached_links(entry), links, block->num_links * sizeof(dynarec_cached_link_t));
+    memcpy(cached_relocs(entry), relocs, block->num_relocs * sizeof(dynarec_reloc_t));
+    memcpy(cached_sites(entry), sites, block->num_sites * sizeof(dynarec_cached_site_t));
+    memcpy(cached_exception_sites(entry), exception_sites, block->num_exception_sites * sizeof(dynarec_cached_exception_site_t));
+
+    for (int i = 0; i < block->num_relocs; i++) {
+        byte* immediate = cached_code(entry) + relocs[i].offset - sizeof(uintptr_t);
+        uintptr_t address;
+        memcpy(&address, immediate, sizeof(uintptr_t));
+        address -= dynarec_reloc_base_address(relocs[i].base);
+        memcpy(immediate, &address, sizeof(uintptr_t));
+    }
+    return entry;
+}
+
+void dynarec_cache_insert(dynarec_cache_entry_t* entry) {
+    size_t size = sizeof(dynarec_cached_block_t) + cached_data_size(&entry->block);
+    if (cache_path[0] == '\0' || bytes_used + size > DYNAREC_CACHE_MAX_BYTES || dynarec_cache_find(&entry->block.key) != NULL) {
+        dynarec_cache_free_entry(entry);
+        return;
+    }
+    insert_entry(entry);
+    dirty = true;
+}
+
+void dynarec_cache_free_entry(dynarec_cache_entry_t* entry) {
+    free(entry->data);
+    free(entry);
+}
+
+uintptr_t dynarec_reloc_base_address(dynarec_reloc_base_t base) {
+    switch (base) {
+        case RELOC_IMAGE:
+            return (uintptr_t)&n64sys;
+        case RELOC_DYNAREC:
+            return (uintptr_t)N64DYNAREC;
+        case RELOC_FASTMEM:
+            return (uintptr_t)fastmem_arena;
+        default:
+            logfatal("Unknown relocation base %d", base);
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef N64_DYNAREC_CACHE_H
+#define N64_DYNAREC_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <util.h>
+
+// Compiled blocks saved to disk, so later runs of the same ROM can install them instead of compiling them again.
+// The file lives next to the ROM, like its save data, and is only used by the build that wrote it.
+
+// What a host address embedded in a block is relative to. Everything else in a block is position independent.
+typedef enum dynarec_reloc_base {
+    RELOC_IMAGE, // Code and globals in the emulator itself
+    RELOC_DYNAREC, // The n64_dynarec_t
+    RELOC_FASTMEM, // The fastmem arena
+    NUM_RELOC_BASES
+} dynarec_reloc_base_t;
+
+// Offsets are from the start of the block's code.
+typedef struct dynarec_reloc {
+    word offset; // Just past the 64 bit immediate holding the address
+    word base;
+} dynarec_reloc_t;
+
+typedef struct dynarec_cached_site {
+    word patch;
+    word access;
+    word slow;
+} dynarec_cached_site_t;
+
+typedef struct dynarec_cached_exception_site {
+    dword pc; // Guest PC of the instruction making the call
+    word return_offset;
+    word unused;
+} dynarec_cached_exception_site_t;
+
+typedef struct dynarec_cached_link {
+    dword target; // Virtual address
+    word jump_end;
+    word unused;
+} dynarec_cached_link_t;
+
+// Compile time state that changes the code generated for a block.
+#define DYNAREC_CACHE_FR      (1 << 0)
+#define DYNAREC_CACHE_FASTMEM (1 << 1)
+
+typedef struct dynarec_cache_key {
+    dword virtual_address;
+    dword guest_hash; // Of the block's instructions
+    word physical_address;
+    word num_instrs;
+    word flags;
+} dynarec_cache_key_t;
+
+// Everything about a cached block except its data, stored as is in the file.
+typedef struct dynarec_cached_block {
+    dynarec_cache_key_t key;
+    word code_size;
+    word body_offset;
+    word num_links;
+    word num_relocs;
+    word num_sites;
+    word num_exception_sites;
+} dynarec_cached_block_t;
+
+typedef struct dynarec_cache_entry {
+    dynarec_cached_block_t block;
+    // The code, padded to 8 bytes, then the links, relocations, fastmem sites and exception sites.
+    byte* data;
+    struct dynarec_cache_entry* next; // In the same bucket
+} dynarec_cache_entry_t;
+
+INLINE size_t cached_code_area(word code_size) {
+    return (code_size + 7) & ~7;
+}
+
+INLINE size_t cached_data_size(dynarec_cached_block_t* block) {
+    return cached_code_area(block->code_size)
+        + block->num_links * sizeof(dynarec_cached_link_t)
+        + block->num_relocs * sizeof(dynarec_reloc_t)
+        + block->num_sites * sizeof(dynarec_cached_site_t)
+        + block->num_exception_sites * sizeof(dynarec_cached_exception_site_t);
+}
+
+INLINE byte* cached_code(dynarec_cache_entry_t* entry) {
+    return entry->data;
+}
+
+INLINE dynarec_cached_link_t* cached_links(dynarec_cache_entry_t* entry) {
+    return (dynarec_cached_link_t*)(entry->data + cached_code_area(entry->block.code_size));
+}
+
+INLINE dynarec_reloc_t* cached_relocs(dynarec_cache_entry_t* entry) {
+    return (dynarec_reloc_t*)(cached_links(entry) + entry->block.num_links);
+}
+
+INLINE dynarec_cached_site_t* cached_sites(dynarec_cache_entry_t* entry) {
+    return (dynarec_cached_site_t*)(cached_relocs(entry) + entry->block.num_relocs);
+}
+
+INLINE dynarec_cached_exception_site_t* cached_exception_sites(dynarec_cache_entry_t* entry) {
+    return (dynarec_cached_exception_site_t*)(cached_sites(entry) + entry->block.num_sites);
+}
+
+// FNV-1a, used for guest code and the build fingerprint.
+#define DYNAREC_CACHE_HASH_INIT 0xCBF29CE484222325ULL
+
+INLINE dword dynarec_cache_hash(dword hash, const void* data, size_t size) {
+    const byte* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+bool dynarec_cache_enabled();
+// Turns the cache on, and loads the one for the current ROM if there is one.
+void dynarec_cache_enable();
+// Saves the cache for the previous ROM and loads the one for the new ROM.
+void dynarec_cache_open(const char* rom_path);
+void dynarec_cache_save();
+
+word dynarec_cache_flags();
+dynarec_cache_entry_t* dynarec_cache_find(dynarec_cache_key_t* key);
+// Makes an entry out of a copy of a block that was just compiled. The code must not have been linked yet.
+// Relocated addresses are stored relative to their base. Safe to call from any thread.
+dynarec_cache_entry_t* dynarec_cache_new_entry(dynarec_cached_block_t* block, byte* code, dynarec_cached_link_t* links,
+                                               dynarec_reloc_t* relocs, dynarec_cached_site_t* sites,
+                                               dynarec_cached_exception_site_t* exception_sites);
+// Adds an entry to the cache, which takes ownership of it. Frees it if it isn't needed.
+void dynarec_cache_insert(dynarec_cache_entry_t* entry);
+void dynarec_cache_free_entry(dynarec_cache_entry_t* entry);
+// What a relocation's stored address is relative to, in this run.
+uintptr_t dynarec_reloc_base_address(dynarec_reloc_base_t base);
+
+#endif //N64_DYNAREC_CACHE_H
@@ -1,34 +1,223 @@
 #include <rsp.h>
 #include "dynarec_memory_management.h"
 #include "dynarec.h"
+#include "fastmem.h"
+#include <log.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Fixed size objects carved out of malloc'd slabs. Freed objects go on a free list, linked through their first bytes.
+typedef struct dynarec_pool {
+    size_t object_size;
+    int objects_per_slab;
+    void* free_list;
+    size_t bytes_reserved;
+} dynarec_pool_t;
+
+static dynarec_pool_t block_list_pool = {
+        .object_size = BLOCKCACHE_INNER_SIZE * sizeof(n64_dynarec_block_t),
+        .objects_per_slab = 16
+};
+
+static dynarec_pool_t code_mask_pool = {
+        .object_size = CODE_MASK_WORDS * sizeof(word),
+        .objects_per_slab = 256
+};
+
+static void* pool_alloc(dynarec_pool_t* pool) {
+    if (pool->free_list == NULL) {
+        byte* slab = malloc(pool->object_size * pool->objects_per_slab);
+        if (slab == NULL) {
+            logfatal("Failed to allocate %ld bytes of dynarec metadata", pool->object_size * pool->objects_per_slab);
+        }
+        pool->bytes_reserved += pool->object_size * pool->objects_per_slab;
+        for (int i = 0; i < pool->objects_per_slab; i++) {
+            void* object = slab + i * pool->object_size;
+            *(void**)object = pool->free_list;
+            pool->free_list = object;
+        }
+    }
+    void* object = pool->free_list;
+    pool->free_list = *(void**)object;
+    memset(object, 0, pool->object_size);
+    return object;
+}
+
+static void pool_free(dynarec_pool_t* pool, void* object) {
+    if (object != NULL) {
+        *(void**)object = pool->free_list;
+        pool->free_list = object;
+    }
+}
+
+n64_dynarec_block_t* dynarec_alloc_block_list() {
+    return pool_alloc(&block_list_pool);
+}
+
+void dynarec_free_block_list(n64_dynarec_block_t* block_list) {
+    pool_free(&block_list_pool, block_list);
+}
+
+word* dynarec_alloc_code_mask() {
+    return pool_alloc(&code_mask_pool);
+}
+
+void dynarec_free_code_mask(word* code_mask) {
+    pool_free(&code_mask_pool, code_mask);
+}
+
+size_t dynarec_metadata_bytes() {
+    return block_list_pool.bytes_reserved + code_mask_pool.bytes_reserved;
+}
+
+// Like fastmem sites, these are registered in the order their blocks are placed in the code cache, so they're at most
+// two runs sorted by return address: everything before `second_exception_run`, and everything after it once allocation
+// has wrapped back around to the start of the code cache.
+static dynarec_exception_site_t* exception_sites = NULL;
+static size_t num_exception_sites = 0;
+static size_t exception_sites_capacity = 0;
+static size_t second_exception_run = 0; // 0 if there's only one run
+
+static int compare_exception_sites(const void* a, const void* b) {
+    uintptr_t address_a = ((const dynarec_exception_site_t*)a)->return_address;
+    uintptr_t address_b = ((const dynarec_exception_site_t*)b)->return_address;
+    return address_a < address_b ? -1 : address_a > address_b;
+}
+
+void dynarec_register_exception_sites(dynarec_exception_site_t* block_sites, int num_block_sites) {
+    if (num_block_sites == 0) {
+        return;
+    }
+    // Calls from the cold section come after the rest of the block, whatever order they were emitted in.
+    qsort(block_sites, num_block_sites, sizeof(dynarec_exception_site_t), compare_exception_sites);
+
+    while (num_exception_sites + num_block_sites > exception_sites_capacity) {
+        exception_sites_capacity = exception_sites_capacity == 0 ? 4096 : exception_sites_capacity * 2;
+        exception_sites = realloc(exception_sites, exception_sites_capacity * sizeof(dynarec_exception_site_t));
+        if (exception_sites == NULL) {
+            logfatal("Failed to allocate space for %ld exception sites", exception_sites_capacity);
+        }
+    }
+    if (num_exception_sites > 0 && block_sites[0].return_address < exception_sites[num_exception_sites - 1].return_address) {
+        if (second_exception_run != 0) {
+            // Shouldn't happen, but merge the runs rather than lose track of any sites
+            qsort(exception_sites, num_exception_sites, sizeof(dynarec_exception_site_t), compare_exception_sites);
+        }
+        second_exception_run = num_exception_sites;
+    }
+    memcpy(&exception_sites[num_exception_sites], block_sites, num_block_sites * sizeof(dynarec_exception_site_t));
+    num_exception_sites += num_block_sites;
+}
+
+void dynarec_clear_exception_sites() {
+    num_exception_sites = 0;
+    second_exception_run = 0;
+}
+
+void dynarec_clear_exception_sites_between(uintptr_t start, uintptr_t end) {
+    size_t kept = 0;
+    second_exception_run = 0;
+    for (size_t i = 0; i < num_exception_sites; i++) {
+        uintptr_t address = exception_sites[i].return_address;
+        if (address >= start && address < end) {
+            continue;
+        }
+        if (kept > 0 && address < exception_sites[kept - 1].return_address) {
+            second_exception_run = kept;
+        }
+        exception_sites[kept++] = exception_sites[i];
+    }
+    num_exception_sites = kept;
+}
+
+static dynarec_exception_site_t* find_exception_site_in(uintptr_t return_address, size_t lo, size_t hi) {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (exception_sites[mid].return_address < return_address) {
+            lo = mid + 1;
+        } else if (exception_sites[mid].return_address > return_address) {
+            hi = mid;
+        } else {
+            return &exception_sites[mid];
+        }
+    }
+    return NULL;
+}
+
+bool dynarec_exception_pc(dword* pc) {
+    if (N64DYNAREC == NULL || N64DYNAREC->exception_frame == NULL) {
+        return false;
+    }
+    // Whatever compiled code is calling right now pushed its return address just below the block's frame.
+    uintptr_t return_address;
+    memcpy(&return_address, N64DYNAREC->exception_frame - sizeof(uintptr_t), sizeof(uintptr_t));
+
+    size_t end = second_exception_run == 0 ? num_exception_sites : second_exception_run;
+    dynarec_exception_site_t* site = find_exception_site_in(return_address, 0, end);
+    if (site == NULL && second_exception_run != 0) {
+        site = find_exception_site_in(return_address, second_exception_run, num_exception_sites);
+    }
+    if (site == NULL) {
+        return false; // Calls that aren't for one instruction, like running delay slots, set prev_pc themselves
+    }
+    *pc = site->pc;
+    return true;
+}
 
 void flush_code_cache() {
-    // Just set the pointer back to the beginning, no need to clear the actual data.
+    // Just set the pointers back to the beginning, no need to clear the actual data.
     N64DYNAREC->codecache_used = 0;
+    N64DYNAREC->codecache_region = 0;
+    for (int i = 0; i < CODECACHE_REGIONS; i++) {
+        N64DYNAREC->codecache_region_used[i] = 0;
+    }
 
     // However, the block cache needs to be fully invalidated.
     for (int i = 0; i < BLOCKCACHE_OUTER_SIZE; i++) {
+        dynarec_free_block_list(N64DYNAREC->blockcache[i]);
+        dynarec_free_code_mask(N64DYNAREC->code_mask[i]);
         N64DYNAREC->blockcache[i] = NULL;
+        N64DYNAREC->code_mask[i] = NULL;
     }
+
+    // Nothing is left to link to or from.
+    reset_dynarec_links();
+
+    // All compiled code is gone, and so are its memory accesses and calls.
+    fastmem_clear_sites();
+    dynarec_clear_exception_sites();
 }
 
 void flush_rsp_code_cache() {
     // Just set the pointer back to the beginning, no need to clear the actual data.
     N64RSPDYNAREC->codecache_used = 0;
 
-    // However, the block cache needs to be fully invalidated.
-    for (int i = 0; i < RSP_BLOCKCACHE_SIZE; i++) {
-        N64RSPDYNAREC->blockcache[i].run = NULL;
+    // However, the block cache needs to be fully invalidated, for every microcode.
+    for (int ucode = 0; ucode < RSP_MAX_UCODES; ucode++) {
+        for (int i = 0; i < RSP_BLOCKCACHE_SIZE; i++) {
+            N64RSPDYNAREC->ucodes[ucode].blocks[i].run = NULL;
+            N64RSPDYNAREC->ucodes[ucode].blocks[i].body = NULL;
+        }
     }
 }
 
 void* dynarec_bumpalloc(size_t size) {
-    if (N64DYNAREC->codecache_used + size >= N64DYNAREC->codecache_size) {
-        flush_code_cache();
+    int region = N64DYNAREC->codecache_region;
+    if (N64DYNAREC->codecache_region_used[region] + size > N64DYNAREC->codecache_region_size) {
+        if (size > N64DYNAREC->codecache_region_size) {
+            logfatal("Tried to allocate %ld bytes in the code cache, but regions are only %ld bytes", size, N64DYNAREC->codecache_region_size);
+        }
+        // Move on to the next region, which is the oldest one. Anything still in there has to go.
+        region = (region + 1) % CODECACHE_REGIONS;
+        N64DYNAREC->codecache_region = region;
+        if (N64DYNAREC->codecache_region_used[region] > 0) {
+            evict_dynarec_region(region);
+        }
     }
 
-    void* ptr = &N64DYNAREC->codecache[N64DYNAREC->codecache_used];
+    void* ptr = &N64DYNAREC->codecache[region * N64DYNAREC->codecache_region_size + N64DYNAREC->codecache_region_used[region]];
 
+    N64DYNAREC->codecache_region_used[region] += size;
     N64DYNAREC->codecache_used += size;
 
 #ifdef N64_LOG_COMPILATIONS
@@ -38,16 +227,6 @@ void* dynarec_bumpalloc(size_t size) {
     return ptr;
 }
 
-void* dynarec_bumpalloc_zero(size_t size) {
-    byte* ptr = dynarec_bumpalloc(size);
-
-    for (int i = 0; i < size; i++) {
-        ptr[i] = 0;
-    }
-
-    return ptr;
-}
-
 void* rsp_dynarec_bumpalloc(size_t size) {
     if (N64RSPDYNAREC->codecache_used + size >= N64RSPDYNAREC->codecache_size) {
         flush_rsp_code_cache();
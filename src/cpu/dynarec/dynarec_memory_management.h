@@ -4,6 +4,26 @@
 #include "dynarec.h"
 
 void* dynarec_bumpalloc(size_t size);
-void* dynarec_bumpalloc_zero(size_t size);
 void* rsp_dynarec_bumpalloc(size_t size);
+
+// Block metadata lives outside of the code cache, in pools that recycle freed page tables.
+// Allocations are zeroed.
+n64_dynarec_block_t* dynarec_alloc_block_list();
+void dynarec_free_block_list(n64_dynarec_block_t* block_list);
+word* dynarec_alloc_code_mask();
+void dynarec_free_code_mask(word* code_mask);
+size_t dynarec_metadata_bytes();
+
+// Calls from compiled code into interpreter handlers that can raise an exception, by their return address, with the
+// guest PC of the instruction making them. Compiled code doesn't keep prev_pc up to date, so this is where it comes from.
+typedef struct dynarec_exception_site {
+    uintptr_t return_address;
+    dword pc;
+} dynarec_exception_site_t;
+
+// Takes all of a block's sites at once, in any order.
+void dynarec_register_exception_sites(dynarec_exception_site_t* block_sites, int num_block_sites);
+void dynarec_clear_exception_sites();
+// Forgets about the sites in a range of the code cache that's being reused.
+void dynarec_clear_exception_sites_between(uintptr_t start, uintptr_t end);
 #endif //N64_DYNAREC_MEMORY_MANAGEMENT_H
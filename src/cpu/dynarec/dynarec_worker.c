@@ -0,0 +1,126 @@
+#include "dynarec_worker.h"
+
+#include <stdlib.h>
+#include <SDL_thread.h>
+#include <SDL_mutex.h>
+#include <SDL_atomic.h>
+#include <log.h>
+
+static SDL_Thread* worker = NULL;
+static SDL_mutex* lock = NULL;
+static SDL_cond* job_queued = NULL;
+static bool stopping = false;
+
+// Both only ever hold DYNAREC_WORKER_MAX_JOBS, since that's all that can be in flight.
+static dynarec_compile_job_t* queued[DYNAREC_WORKER_MAX_JOBS];
+static int queued_head = 0;
+static int num_queued = 0;
+static dynarec_compile_job_t* finished[DYNAREC_WORKER_MAX_JOBS];
+static int finished_head = 0;
+static SDL_atomic_t num_finished;
+
+static int jobs_in_flight = 0; // Only touched by the emulation thread
+
+static int worker_main(void* data) {
+    SDL_LockMutex(lock);
+    while (true) {
+        while (num_queued == 0 && !stopping) {
+            SDL_CondWait(job_queued, lock);
+        }
+        if (stopping) {
+            break;
+        }
+        dynarec_compile_job_t* job = queued[queued_head];
+        queued_head = (queued_head + 1) % DYNAREC_WORKER_MAX_JOBS;
+        num_queued--;
+        SDL_UnlockMutex(lock);
+
+        job->result = compile_block_job(job);
+
+        SDL_LockMutex(lock);
+        int tail = (finished_head + SDL_AtomicGet(&num_finished)) % DYNAREC_WORKER_MAX_JOBS;
+        finished[tail] = job;
+        SDL_AtomicAdd(&num_finished, 1);
+    }
+    SDL_UnlockMutex(lock);
+    return 0;
+}
+
+bool dynarec_worker_running() {
+    return worker != NULL;
+}
+
+void dynarec_worker_start() {
+    if (worker != NULL) {
+        return;
+    }
+    lock = SDL_CreateMutex();
+    job_queued = SDL_CreateCond();
+    if (lock == NULL || job_queued == NULL) {
+        logfatal("Failed to create the dynarec worker's lock: %s", SDL_GetError());
+    }
+    stopping = false;
+    SDL_AtomicSet(&num_finished, 0);
+    worker = SDL_CreateThread(worker_main, "dynarec worker", NULL);
+    if (worker == NULL) {
+        logwarn("Failed to start the dynarec worker, compiling on the emulation thread instead: %s", SDL_GetError());
+        return;
+    }
+    logalways("Compiling blocks in the background");
+}
+
+void dynarec_worker_stop() {
+    if (worker == NULL) {
+        return;
+    }
+    SDL_LockMutex(lock);
+    stopping = true;
+    SDL_CondSignal(job_queued);
+    SDL_UnlockMutex(lock);
+    SDL_WaitThread(worker, NULL);
+    worker = NULL;
+
+    for (int i = 0; i < num_queued; i++) {
+        free(queued[(queued_head + i) % DYNAREC_WORKER_MAX_JOBS]);
+    }
+    num_queued = 0;
+    dynarec_compile_job_t* job;
+    while ((job = dynarec_worker_take_finished()) != NULL) {
+        dynarec_cache_free_entry(job->result);
+        free(job);
+    }
+    jobs_in_flight = 0;
+
+    SDL_DestroyCond(job_queued);
+    SDL_DestroyMutex(lock);
+    job_queued = NULL;
+    lock = NULL;
+}
+
+bool dynarec_worker_submit(dynarec_compile_job_t* job) {
+    if (jobs_in_flight == DYNAREC_WORKER_MAX_JOBS) {
+        return false;
+    }
+    jobs_in_flight++;
+    job->result = NULL;
+    SDL_LockMutex(lock);
+    queued[(queued_head + num_queued) % DYNAREC_WORKER_MAX_JOBS] = job;
+    num_queued++;
+    SDL_CondSignal(job_queued);
+    SDL_UnlockMutex(lock);
+    return true;
+}
+
+dynarec_compile_job_t* dynarec_worker_take_finished() {
+    // Checked every block, so don't take the lock unless there's something there
+    if (SDL_AtomicGet(&num_finished) == 0) {
+        return NULL;
+    }
+    SDL_LockMutex(lock);
+    dynarec_compile_job_t* job = finished[finished_head];
+    finished_head = (finished_head + 1) % DYNAREC_WORKER_MAX_JOBS;
+    SDL_AtomicAdd(&num_finished, -1);
+    SDL_UnlockMutex(lock);
+    jobs_in_flight--;
+    return job;
+}
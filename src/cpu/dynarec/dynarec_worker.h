@@ -0,0 +1,32 @@
+#ifndef N64_DYNAREC_WORKER_H
+#define N64_DYNAREC_WORKER_H
+
+#include <stdbool.h>
+#include "dynarec.h"
+#include "dynarec_cache.h"
+
+// Blocks can be compiled on a background thread, while the interpreter runs them in the meantime. The worker compiles
+// from a copy of the block's instructions, and hands back a translation cache entry that the emulation thread
+// installs, so nothing the emulation thread uses is touched off of it.
+
+// Jobs queued, being compiled, or waiting to be installed
+#define DYNAREC_WORKER_MAX_JOBS 256
+
+typedef struct dynarec_compile_job {
+    dynarec_cache_key_t key;
+    word instrs[MAX_BLOCK_INSTRS];
+    dynarec_cache_entry_t* result; // Filled in by the worker
+} dynarec_compile_job_t;
+
+bool dynarec_worker_running();
+void dynarec_worker_start();
+void dynarec_worker_stop();
+// Returns false if too many jobs are in flight already, the caller keeps ownership of the job in that case.
+bool dynarec_worker_submit(dynarec_compile_job_t* job);
+// Returns a finished job, or NULL if there are none.
+dynarec_compile_job_t* dynarec_worker_take_finished();
+
+// Called on the worker thread, in dynarec.c
+dynarec_cache_entry_t* compile_block_job(dynarec_compile_job_t* job);
+
+#endif //N64_DYNAREC_WORKER_H
@@ -0,0 +1,244 @@
+#ifndef N64_WIN
+#define _GNU_SOURCE
+#endif
+#include "fastmem.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <log.h>
+#include <system/n64system.h>
+#include <mem/addresses.h>
+#include <rsp.h>
+
+#if defined(__linux__) && defined(__x86_64__)
+#define N64_FASTMEM_SUPPORTED
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#endif
+
+#define FASTMEM_PAGE_SIZE 0x1000
+
+byte* fastmem_arena = NULL;
+
+typedef struct fastmem_site {
+    uintptr_t patch;
+    uintptr_t access;
+    uintptr_t slow_path;
+} fastmem_site_t;
+
+// Sites are registered in the order their blocks are placed in the code cache. Regions of the code cache are reused
+// oldest first, so this is at most two runs sorted by address: everything before `second_run`, and everything after it
+// once allocation has wrapped back around to the start of the code cache.
+static fastmem_site_t* sites = NULL;
+static size_t num_sites = 0;
+static size_t sites_capacity = 0;
+static size_t second_run = 0; // 0 if there's only one run
+
+static int compare_sites(const void* a, const void* b) {
+    uintptr_t access_a = ((const fastmem_site_t*)a)->access;
+    uintptr_t access_b = ((const fastmem_site_t*)b)->access;
+    return access_a < access_b ? -1 : access_a > access_b;
+}
+
+void fastmem_register_site(uintptr_t patch, uintptr_t access, uintptr_t slow_path) {
+    if (num_sites == sites_capacity) {
+        sites_capacity = sites_capacity == 0 ? 4096 : sites_capacity * 2;
+        sites = realloc(sites, sites_capacity * sizeof(fastmem_site_t));
+        if (sites == NULL) {
+            logfatal("Failed to allocate space for %ld fastmem sites", sites_capacity);
+        }
+    }
+    if (num_sites > 0 && access < sites[num_sites - 1].access) {
+        if (second_run != 0) {
+            // Shouldn't happen, but merge the runs rather than lose track of any sites
+            qsort(sites, num_sites, sizeof(fastmem_site_t), compare_sites);
+        }
+        second_run = num_sites;
+    }
+    sites[num_sites].patch = patch;
+    sites[num_sites].access = access;
+    sites[num_sites].slow_path = slow_path;
+    num_sites++;
+}
+
+void fastmem_clear_sites() {
+    num_sites = 0;
+    second_run = 0;
+}
+
+void fastmem_clear_sites_between(uintptr_t start, uintptr_t end) {
+    size_t kept = 0;
+    second_run = 0;
+    for (size_t i = 0; i < num_sites; i++) {
+        if (sites[i].patch >= start && sites[i].patch < end) {
+            continue;
+        }
+        if (kept > 0 && sites[i].access < sites[kept - 1].access) {
+            second_run = kept;
+        }
+        sites[kept++] = sites[i];
+    }
+    num_sites = kept;
+}
+
+#ifdef N64_FASTMEM_SUPPORTED
+static fastmem_site_t* find_site_in(uintptr_t access, size_t lo, size_t hi) {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sites[mid].access < access) {
+            lo = mid + 1;
+        } else if (sites[mid].access > access) {
+            hi = mid;
+        } else {
+            return &sites[mid];
+        }
+    }
+    return NULL;
+}
+
+static fastmem_site_t* find_site(uintptr_t access) {
+    if (second_run == 0) {
+        return find_site_in(access, 0, num_sites);
+    }
+    fastmem_site_t* site = find_site_in(access, 0, second_run);
+    return site != NULL ? site : find_site_in(access, second_run, num_sites);
+}
+
+static void backpatch(fastmem_site_t* site) {
+    // jmp rel32 from the start of the sequence to the slow path. The sequence always begins with a 10 byte mov64,
+    // so there's enough room for it.
+    byte* patch = (byte*)site->patch;
+    sword rel = (sword)(site->slow_path - (site->patch + 5));
+    patch[0] = 0xE9;
+    memcpy(&patch[1], &rel, sizeof(sword));
+}
+
+static void fastmem_fault_handler(int sig, siginfo_t* info, void* raw_context) {
+    ucontext_t* context = raw_context;
+    uintptr_t rip = context->uc_mcontext.gregs[REG_RIP];
+    uintptr_t fault_address = (uintptr_t)info->si_addr;
+    bool in_arena = fault_address >= (uintptr_t)fastmem_arena && fault_address < (uintptr_t)fastmem_arena + FASTMEM_ARENA_SIZE;
+
+    fastmem_site_t* site = in_arena ? find_site(rip) : NULL;
+    if (site == NULL) {
+        // Not ours. Put the default handler back, returning will re-execute the faulting instruction and crash as usual.
+        signal(sig, SIG_DFL);
+        return;
+    }
+
+    backpatch(site);
+    context->uc_mcontext.gregs[REG_RIP] = site->slow_path;
+}
+
+static void map_shared(void* address, size_t size, int prot, int fd, off_t offset, const char* thing) {
+    if (mmap(address, size, prot, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED) {
+        logfatal("Failed to map %s for fastmem: %s", thing, strerror(errno));
+    }
+}
+
+// Moves the memory backing `host` into a shared memory file, preserving its contents, so it can also be mapped into
+// the arena. Returns the file descriptor.
+static int alias_into_arena(const char* name, byte* host, size_t size) {
+    int fd = memfd_create(name, 0);
+    if (fd < 0) {
+        logfatal("memfd_create failed for %s: %s", name, strerror(errno));
+    }
+    if (ftruncate(fd, size) != 0) {
+        logfatal("ftruncate failed for %s: %s", name, strerror(errno));
+    }
+    if (pwrite(fd, host, size, 0) != size) {
+        logfatal("Failed to copy %s into shared memory: %s", name, strerror(errno));
+    }
+    map_shared(host, size, PROT_READ | PROT_WRITE, fd, 0, name);
+    return fd;
+}
+#endif
+
+bool fastmem_init() {
+#ifdef N64_FASTMEM_SUPPORTED
+    if (fastmem_enabled()) {
+        return true;
+    }
+
+    _Static_assert(((uintptr_t)N64_RDRAM_SIZE % FASTMEM_PAGE_SIZE) == 0, "RDRAM must be a whole number of pages");
+    if (((uintptr_t)n64sys.mem.rdram % FASTMEM_PAGE_SIZE) != 0 || ((uintptr_t)N64RSP.sp_dmem % FASTMEM_PAGE_SIZE) != 0) {
+        logwarn("RDRAM and SP DMEM must be page aligned for fastmem, disabling it");
+        return false;
+    }
+
+    byte* arena = mmap(NULL, FASTMEM_ARENA_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena == MAP_FAILED) {
+        logwarn("Failed to reserve the fastmem arena, disabling it: %s", strerror(errno));
+        return false;
+    }
+
+    int rdram_fd = alias_into_arena("n64-rdram", n64sys.mem.rdram, N64_RDRAM_SIZE);
+    map_shared(arena + SREGION_RDRAM, N64_RDRAM_SIZE, PROT_READ | PROT_WRITE, rdram_fd, 0, "RDRAM");
+    close(rdram_fd);
+
+    // DMEM and IMEM are adjacent in both the physical address space and rsp_t.
+    // IMEM is mapped read only, so CPU writes to it go through the bus and invalidate the RSP's icache.
+    _Static_assert(SREGION_SP_IMEM - SREGION_SP_DMEM == SP_DMEM_SIZE, "IMEM must immediately follow DMEM");
+    int sp_fd = alias_into_arena("n64-sp-mem", N64RSP.sp_dmem, SP_DMEM_SIZE + SP_IMEM_SIZE);
+    map_shared(arena + SREGION_SP_DMEM, SP_DMEM_SIZE, PROT_READ | PROT_WRITE, sp_fd, 0, "SP DMEM");
+    map_shared(arena + SREGION_SP_IMEM, SP_IMEM_SIZE, PROT_READ, sp_fd, SP_DMEM_SIZE, "SP IMEM");
+    close(sp_fd);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = fastmem_fault_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, NULL) != 0) {
+        logfatal("Failed to install the fastmem fault handler: %s", strerror(errno));
+    }
+
+    fastmem_arena = arena;
+
+    if (n64sys.mem.rom.rom != NULL) {
+        fastmem_map_rom(n64sys.mem.rom.rom, n64sys.mem.rom.size);
+    }
+
+    logalways("Fastmem enabled, arena at %p", fastmem_arena);
+    return true;
+#else
+    logwarn("Fastmem is not supported on this platform");
+    return false;
+#endif
+}
+
+void fastmem_map_rom(byte* rom, size_t size) {
+#ifdef N64_FASTMEM_SUPPORTED
+    if (!fastmem_enabled()) {
+        return;
+    }
+    const size_t region_size = EREGION_CART_1_2 - SREGION_CART_1_2 + 1;
+    // The ISViewer registers are past the end of all but the largest ROMs, stop before their page so they go through the bus
+    const size_t max_mapped_size = (CART_ISVIEWER_FLUSH & ~(FASTMEM_PAGE_SIZE - 1)) - SREGION_CART_1_2;
+    byte* base = fastmem_arena + SREGION_CART_1_2;
+
+    // Throw away whatever ROM was mapped before
+    if (mmap(base, region_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        logfatal("Failed to reset the fastmem cartridge region: %s", strerror(errno));
+    }
+
+    // Only whole pages are mapped, anything past the end of the ROM goes through the bus.
+    size_t mapped_size = size & ~(FASTMEM_PAGE_SIZE - 1);
+    if (mapped_size > max_mapped_size) {
+        mapped_size = max_mapped_size;
+    }
+    if (mapped_size == 0) {
+        return;
+    }
+    if (mprotect(base, mapped_size, PROT_READ | PROT_WRITE) != 0) {
+        logfatal("Failed to map the ROM for fastmem: %s", strerror(errno));
+    }
+    memcpy(base, rom, mapped_size);
+    if (mprotect(base, mapped_size, PROT_READ) != 0) {
+        logfatal("Failed to protect the ROM for fastmem: %s", strerror(errno));
+    }
+#endif
+}
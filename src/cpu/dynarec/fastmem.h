@@ -0,0 +1,30 @@
+#ifndef N64_FASTMEM_H
+#define N64_FASTMEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <util.h>
+
+// The whole 32 bit physical address space is reserved as a single host mapping.
+// RDRAM, SP DMEM/IMEM and the cartridge ROM (up to the ISViewer) are mapped at their physical addresses, everything else
+// is left inaccessible. Only word and dword accesses use the ROM mapping, the bus rounds smaller ones.
+#define FASTMEM_ARENA_SIZE 0x100000000ULL
+
+extern byte* fastmem_arena;
+
+INLINE bool fastmem_enabled() {
+    return fastmem_arena != NULL;
+}
+
+bool fastmem_init();
+void fastmem_map_rom(byte* rom, size_t size);
+
+// Compiled memory accesses register themselves here so the fault handler can backpatch them.
+// patch: the start of the inline access sequence, overwritten with a jump to slow_path on the first fault.
+// access: the host instruction that actually touches the arena.
+void fastmem_register_site(uintptr_t patch, uintptr_t access, uintptr_t slow_path);
+void fastmem_clear_sites();
+// Forgets about the sites in a range of the code cache that's being reused.
+void fastmem_clear_sites_between(uintptr_t start, uintptr_t end);
+
+#endif //N64_FASTMEM_H
@@ -3,6 +3,7 @@
 #include "rsp_dynarec.h"
 #include "asm_emitter.h"
 #include "dynarec_memory_management.h"
+#include "dynarec_cache.h"
 
 void* rsp_link_and_encode(dasm_State** d) {
     size_t code_size;
@@ -18,11 +19,110 @@ void* rsp_link_and_encode(dasm_State** d) {
 
 #define NEXT(address) ((address + 4) & 0xFFF)
 
+// Vector unit state is cached in XMM registers for as long as a block only runs native code. Every XMM
+// register is treated as caller saved, so anything that calls out to the interpreter writes it all back first. On
+// Windows, where xmm6-xmm15 are callee saved, the prologue saves them for the host.
+typedef struct rsp_host_xmm_state {
+    int slot; // RSP_VU_* slot, -1 if free
+    bool dirty;
+    int last_used;
+} rsp_host_xmm_state_t;
+
+static rsp_host_xmm_state_t host_xmms[RSP_VU_NUM_HOST_XMM];
+static int slot_to_host_xmm[RSP_VU_NUM_SLOTS]; // -1 if the slot isn't cached
+static word pinned_host_xmms;
+static int current_instr;
+
+INLINE int host_xmm(int index) {
+    return RSP_VU_FIRST_HOST_XMM + index;
+}
+
+static void reset_host_xmms() {
+    for (int i = 0; i < RSP_VU_NUM_HOST_XMM; i++) {
+        host_xmms[i].slot = -1;
+        host_xmms[i].dirty = false;
+        host_xmms[i].last_used = -1;
+    }
+    for (int slot = 0; slot < RSP_VU_NUM_SLOTS; slot++) {
+        slot_to_host_xmm[slot] = -1;
+    }
+    pinned_host_xmms = 0;
+}
+
+static void flush_vu_slot(dasm_State** Dst, int slot) {
+    int index = slot_to_host_xmm[slot];
+    if (index >= 0) {
+        if (host_xmms[index].dirty) {
+            flush_rsp_vu_slot(Dst, host_xmm(index), slot);
+        }
+        host_xmms[index].slot = -1;
+        host_xmms[index].dirty = false;
+        slot_to_host_xmm[slot] = -1;
+    }
+}
+
+static void flush_all_vu(dasm_State** Dst) {
+    for (int slot = 0; slot < RSP_VU_NUM_SLOTS; slot++) {
+        flush_vu_slot(Dst, slot);
+    }
+}
+
+static int alloc_host_xmm(dasm_State** Dst) {
+    int victim = -1;
+    for (int i = 0; i < RSP_VU_NUM_HOST_XMM; i++) {
+        if (host_xmms[i].slot < 0) {
+            return i;
+        }
+        if (pinned_host_xmms & (1 << i)) {
+            continue;
+        }
+        if (victim < 0 || host_xmms[i].last_used < host_xmms[victim].last_used) {
+            victim = i;
+        }
+    }
+    if (victim < 0) {
+        logfatal("Ran out of host XMM registers for the RSP vector unit!");
+    }
+    flush_vu_slot(Dst, host_xmms[victim].slot);
+    return victim;
+}
+
+// Host XMM register holding a slot, loading it if needed. Marked dirty if the instruction writes it.
+static int map_vu_slot(dasm_State** Dst, int slot, bool load, bool write) {
+    int index = slot_to_host_xmm[slot];
+    if (index < 0) {
+        index = alloc_host_xmm(Dst);
+        host_xmms[index].slot = slot;
+        host_xmms[index].dirty = false;
+        slot_to_host_xmm[slot] = index;
+        if (load) {
+            load_rsp_vu_slot(Dst, host_xmm(index), slot);
+        }
+    }
+    host_xmms[index].dirty |= write;
+    host_xmms[index].last_used = current_instr;
+    pinned_host_xmms |= 1 << index;
+    return host_xmm(index);
+}
+
+// Fills in the arguments a vector compiler expects, see RSP_VU_ARG(). Returns vd's host register.
+static int map_vector_operands(dasm_State** Dst, mips_instruction_t instr, dynarec_ir_t* ir, int* args) {
+    pinned_host_xmms = 0;
+    args[RSP_VU_ARG_VS] = map_vu_slot(Dst, instr.cp2_vec.vs, true, false);
+    args[RSP_VU_ARG_VT] = map_vu_slot(Dst, instr.cp2_vec.vt, true, false);
+    for (int slot = RSP_VU_ACC_H; slot < RSP_VU_NUM_SLOTS; slot++) {
+        if (ir->vu_state & RSP_VU_STATE(slot)) {
+            args[RSP_VU_ARG(slot)] = map_vu_slot(Dst, slot, true, true);
+        }
+    }
+    return map_vu_slot(Dst, instr.cp2_vec.vd, (ir->vu_state & RSP_VU_READS_VD) != 0, true);
+}
+
 void compile_new_rsp_block(rsp_dynarec_block_t* block, half address) {
     static dasm_State* d;
     static dasm_State** Dst;
 
-    d = block_header();
+    d = block_header(false);
     Dst = &d;
 
     int block_length = 0;
@@ -33,6 +133,9 @@ void compile_new_rsp_block(rsp_dynarec_block_t* block, half address) {
     bool branch_in_block = false;
 
     dynarec_instruction_category_t prev_instr_category = NORMAL;
+    int vector_args[RSP_VU_NUM_ARGS];
+    reset_host_xmms();
+    current_instr = 0;
 
     do {
         static mips_instruction_t instr;
@@ -50,8 +153,16 @@ void compile_new_rsp_block(rsp_dynarec_block_t* block, half address) {
 
         //advance_rsp_pc(Dst);
 
-        ir->compiler(Dst, instr, address, NULL, 0, &extra_cycles);
+        int vd = 0;
+        if (ir->format == VECTOR) {
+            vd = map_vector_operands(Dst, instr, ir, vector_args);
+        } else if (ir->format == CALL_INTERPRETER) {
+            flush_all_vu(Dst);
+        }
+
+        ir->compiler(Dst, instr, address, vector_args, vd, &extra_cycles);
         block_length++;
+        current_instr++;
         block_extra_cycles += extra_cycles;
 
         switch (ir->category) {
@@ -93,6 +204,7 @@ void compile_new_rsp_block(rsp_dynarec_block_t* block, half address) {
         prev_instr_category = ir->category;
     } while(should_continue_block);
 
+    flush_all_vu(Dst);
     if (!branch_in_block) {
         flush_rsp_pc(Dst, address >> 2);
         flush_rsp_next_pc(Dst, NEXT(address) >> 2);
@@ -100,9 +212,9 @@ void compile_new_rsp_block(rsp_dynarec_block_t* block, half address) {
 
     end_rsp_block(Dst, block_length + block_extra_cycles);
     void* compiled = rsp_link_and_encode(Dst);
-    dasm_free(Dst);
-
     block->run = compiled;
+    block->body = get_dynamic_label_address(Dst, compiled, BLOCK_BODY_LABEL);
+    dasm_free(Dst);
 }
 
 int rsp_missing_block_handler() {
@@ -118,16 +230,49 @@ rsp_dynarec_t* rsp_dynarec_init(byte* codecache, size_t codecache_size) {
     dynarec->codecache_size = codecache_size;
     dynarec->codecache_used = 0;
 
-    for (int i = 0; i < RSP_BLOCKCACHE_SIZE; i++) {
-        dynarec->blockcache[i].run = rsp_missing_block_handler;
-    }
+    // Blocks are looked up by IMEM's contents, which haven't been seen yet
+    rsp_dynarec_imem_written(dynarec);
 
     dynarec->codecache = codecache;
 
     return dynarec;
 }
 
+// Switches to the blocks for what's in IMEM now, after it's been written to. Microcode that hasn't been seen before
+// takes over the least recently used slot. The code of whatever was there is left in the code cache until it's flushed.
+static void select_ucode() {
+    rsp_dynarec_t* dynarec = N64RSPDYNAREC;
+    dword hash = dynarec_cache_hash(DYNAREC_CACHE_HASH_INIT, N64RSP.sp_imem, SP_IMEM_SIZE);
+    dynarec->ucode_clock++;
+    dynarec->imem_dirty = false;
+
+    rsp_dynarec_ucode_t* victim = NULL;
+    for (int i = 0; i < RSP_MAX_UCODES; i++) {
+        rsp_dynarec_ucode_t* ucode = &dynarec->ucodes[i];
+        if (ucode->valid && ucode->hash == hash) {
+            ucode->last_used = dynarec->ucode_clock;
+            dynarec->blockcache = ucode->blocks;
+            return;
+        }
+        if (victim == NULL || (victim->valid && (!ucode->valid || ucode->last_used < victim->last_used))) {
+            victim = ucode;
+        }
+    }
+
+    for (int i = 0; i < RSP_BLOCKCACHE_SIZE; i++) {
+        victim->blocks[i].run = NULL;
+        victim->blocks[i].body = NULL;
+    }
+    victim->valid = true;
+    victim->hash = hash;
+    victim->last_used = dynarec->ucode_clock;
+    dynarec->blockcache = victim->blocks;
+}
+
 int rsp_dynarec_step() {
+    if (unlikely(N64RSPDYNAREC->imem_dirty)) {
+        select_ucode();
+    }
     rsp_dynarec_block_t* block = &N64RSPDYNAREC->blockcache[N64RSP.pc & 0x3FF];
     // temporary...
     if (block->run == NULL) {
@@ -8,21 +8,70 @@
 // Temporarily just the same size as IMEM
 #define RSP_BLOCKCACHE_SIZE (0x1000 / 4)
 
+// Vector unit state cached in host XMM registers by the recompiler: the 32 vector registers, then the accumulator
+// slices and the flag registers.
+#define RSP_VU_ACC_H 32
+#define RSP_VU_ACC_M 33
+#define RSP_VU_ACC_L 34
+#define RSP_VU_VCC_L 35
+#define RSP_VU_VCC_H 36
+#define RSP_VU_VCO_L 37
+#define RSP_VU_VCO_H 38
+#define RSP_VU_VCE   39
+#define RSP_VU_NUM_SLOTS 40
+
+// Which of the state slots above a vector instruction uses, in its IR's vu_state.
+#define RSP_VU_STATE(slot) (1 << ((slot) - RSP_VU_ACC_H))
+// vd is only partially written, so its old value has to be loaded.
+#define RSP_VU_READS_VD (1 << 8)
+
+// Layout of the arguments vector compilers get: vs, vt, then one for each state slot. vd is passed as the destination.
+#define RSP_VU_ARG_VS 0
+#define RSP_VU_ARG_VT 1
+#define RSP_VU_ARG(slot) (2 + (slot) - RSP_VU_ACC_H)
+#define RSP_VU_NUM_ARGS RSP_VU_ARG(RSP_VU_NUM_SLOTS)
+
 typedef struct rsp rsp_t;
 
 typedef struct rsp_dynarec_block {
     int (*run)(rsp_t* cpu);
+    // Past the prologue, blocks jump straight here when they chain to this one. NULL until the block is compiled.
+    void* body;
 } rsp_dynarec_block_t;
 
+_Static_assert(sizeof(rsp_dynarec_block_t) == 16, "Generated code expects RSP block cache entries to be 16 bytes");
+
+// Games switch between a few microcodes every frame, so the blocks for each one are kept around, keyed by a hash of
+// IMEM. Switching back to one that's been seen before picks its blocks back up instead of recompiling them.
+#define RSP_MAX_UCODES 8
+
+typedef struct rsp_dynarec_ucode {
+    bool valid;
+    dword hash; // Of all of IMEM
+    dword last_used;
+    rsp_dynarec_block_t blocks[RSP_BLOCKCACHE_SIZE];
+} rsp_dynarec_ucode_t;
+
 typedef struct rsp_dynarec {
     byte* codecache;
     dword codecache_size;
     dword codecache_used;
 
-    rsp_dynarec_block_t blockcache[RSP_BLOCKCACHE_SIZE];
+    // Blocks for the microcode in IMEM. Once IMEM is written to, this points at no_blocks until the next dispatch
+    // looks the new contents up, so running code can't chain into blocks compiled from what used to be there.
+    rsp_dynarec_block_t* blockcache;
+    bool imem_dirty;
+    dword ucode_clock; // For picking the least recently used microcode to replace
+    rsp_dynarec_ucode_t ucodes[RSP_MAX_UCODES];
+    rsp_dynarec_block_t no_blocks[RSP_BLOCKCACHE_SIZE];
 } rsp_dynarec_t;
 
 rsp_dynarec_t* rsp_dynarec_init(byte* codecache, size_t codecache_size);
 int rsp_dynarec_step();
 
+INLINE void rsp_dynarec_imem_written(rsp_dynarec_t* dynarec) {
+    dynarec->imem_dirty = true;
+    dynarec->blockcache = dynarec->no_blocks;
+}
+
 #endif //N64_RSP_DYNAREC_H
@@ -7,7 +7,7 @@
 
 #include "r4300i_register_access.h"
 
-#define checkcp1 do { if (!N64CPU.cp0.status.cu1) { r4300i_handle_exception(N64CPU.prev_pc, EXCEPTION_COPROCESSOR_UNUSABLE, 1); return; } } while(0)
+#define checkcp1 do { if (!N64CPU.cp0.status.cu1) { r4300i_handle_exception(r4300i_exception_pc(), EXCEPTION_COPROCESSOR_UNUSABLE, 1); return; } } while(0)
 #ifdef N64_WIN
 #define ORDERED_S(fs, ft) do { if (isnan(fs) || isnan(ft)) { logfatal("we got some nans, time to panic"); } } while (0)
 #define ORDERED_D(fs, ft) do { if (isnan(fs) || isnan(ft)) { logfatal("we got some nans, time to panic"); } } while (0)
@@ -95,6 +95,33 @@ INLINE void check_fpu_exception() {
     }
 }
 
+INLINE void set_fpu_exception_bits(int raised) {
+    if (raised & FE_INVALID) {
+        N64CPU.fcr31.cause_invalid_operation = true;
+        N64CPU.fcr31.flag_invalid_operation = true;
+    }
+    if (raised & FE_OVERFLOW) {
+        N64CPU.fcr31.cause_overflow = true;
+        N64CPU.fcr31.flag_overflow = true;
+    }
+    if (raised & FE_UNDERFLOW) {
+        N64CPU.fcr31.cause_underflow = true;
+        N64CPU.fcr31.flag_underflow = true;
+    }
+    if (raised & FE_INEXACT) {
+        N64CPU.fcr31.cause_inexact_operation = true;
+        N64CPU.fcr31.flag_inexact_operation = true;
+    }
+}
+
+// Arithmetic records the exceptions the host saw while computing its result in FCR31's cause and flag bits, the same
+// way the native code in the dynarec does with MXCSR. Division by zero is checked for before dividing instead.
+#define FPU_ARITH(operation) do { \
+        feclearexcept(FE_ALL_EXCEPT); \
+        operation; \
+        set_fpu_exception_bits(fetestexcept(FE_INVALID | FE_OVERFLOW | FE_UNDERFLOW | FE_INEXACT)); \
+    } while (0)
+
 INLINE int push_round_mode() {
     int orig_round = fegetround();
     switch (N64CPU.fcr31.rounding_mode) {
@@ -161,7 +188,8 @@ MIPS_INSTR(mips_cp_mul_d) {
     double fs = get_fpu_register_double(instruction.fr.fs);
     double ft = get_fpu_register_double(instruction.fr.ft);
     checknansd(fs, ft);
-    double result = fs * ft;
+    double result;
+    FPU_ARITH(result = fs * ft);
     set_fpu_register_double(instruction.fr.fd, result);
 }
 
@@ -170,7 +198,8 @@ MIPS_INSTR(mips_cp_mul_s) {
     float fs = get_fpu_register_float(instruction.fr.fs);
     float ft = get_fpu_register_float(instruction.fr.ft);
     checknansf(fs, ft);
-    float result = fs * ft;
+    float result;
+    FPU_ARITH(result = fs * ft);
     set_fpu_register_float(instruction.fr.fd, result);
 }
 
@@ -183,7 +212,8 @@ MIPS_INSTR(mips_cp_div_d) {
         N64CPU.fcr31.cause_division_by_zero = true;
         check_fpu_exception();
     }
-    double result = fs / ft;
+    double result;
+    FPU_ARITH(result = fs / ft);
     set_fpu_register_double(instruction.fr.fd, result);
 }
 
@@ -196,7 +226,8 @@ MIPS_INSTR(mips_cp_div_s) {
         N64CPU.fcr31.cause_division_by_zero = true;
         check_fpu_exception();
     }
-    float result = fs / ft;
+    float result;
+    FPU_ARITH(result = fs / ft);
     set_fpu_register_float(instruction.fr.fd, result);
 }
 
@@ -205,7 +236,8 @@ MIPS_INSTR(mips_cp_add_d) {
     double fs = get_fpu_register_double(instruction.fr.fs);
     double ft = get_fpu_register_double(instruction.fr.ft);
     checknansd(fs, ft);
-    double result = fs + ft;
+    double result;
+    FPU_ARITH(result = fs + ft);
     set_fpu_register_double(instruction.fr.fd, result);
 }
 
@@ -214,7 +246,8 @@ MIPS_INSTR(mips_cp_add_s) {
     float fs = get_fpu_register_float(instruction.fr.fs);
     float ft = get_fpu_register_float(instruction.fr.ft);
     checknansf(fs, ft);
-    float result = fs + ft;
+    float result;
+    FPU_ARITH(result = fs + ft);
     set_fpu_register_float(instruction.fr.fd, result);
 }
 
@@ -223,7 +256,8 @@ MIPS_INSTR(mips_cp_sub_d) {
     double fs = get_fpu_register_double(instruction.fr.fs);
     double ft = get_fpu_register_double(instruction.fr.ft);
     checknansd(fs, ft);
-    double result = fs - ft;
+    double result;
+    FPU_ARITH(result = fs - ft);
     set_fpu_register_double(instruction.fr.fd, result);
 }
 
@@ -232,7 +266,8 @@ MIPS_INSTR(mips_cp_sub_s) {
     float fs = get_fpu_register_float(instruction.fr.fs);
     float ft = get_fpu_register_float(instruction.fr.ft);
     checknansf(fs, ft);
-    float result = fs - ft;
+    float result;
+    FPU_ARITH(result = fs - ft);
     set_fpu_register_float(instruction.fr.fd, result);
 }
 
@@ -341,14 +376,18 @@ MIPS_INSTR(mips_cp_cvt_d_l) {
 MIPS_INSTR(mips_cp_cvt_l_s) {
     checkcp1;
     float fs = get_fpu_register_float(instruction.fr.fs);
-    sdword converted = fs;
+    PUSHROUND;
+    sdword converted = nearbyintf(fs);
+    POPROUND;
     set_fpu_register_dword(instruction.fr.fd, converted);
 }
 
 MIPS_INSTR(mips_cp_cvt_l_d) {
     checkcp1;
     double fs = get_fpu_register_double(instruction.fr.fs);
-    sdword converted = fs;
+    PUSHROUND;
+    sdword converted = nearbyint(fs);
+    POPROUND;
     set_fpu_register_dword(instruction.fr.fd, converted);
 }
 
@@ -376,28 +415,34 @@ MIPS_INSTR(mips_cp_cvt_s_l) {
 MIPS_INSTR(mips_cp_cvt_w_s) {
     checkcp1;
     float fs = get_fpu_register_float(instruction.fr.fs);
-    sword converted = fs;
+    PUSHROUND;
+    sword converted = nearbyintf(fs);
+    POPROUND;
     set_fpu_register_word(instruction.fr.fd, converted);
 }
 
 MIPS_INSTR(mips_cp_cvt_w_d) {
     checkcp1;
     double fs = get_fpu_register_double(instruction.fr.fs);
-    sword converted = fs;
+    PUSHROUND;
+    sword converted = nearbyint(fs);
+    POPROUND;
     set_fpu_register_word(instruction.fr.fd, converted);
 }
 
 MIPS_INSTR(mips_cp_sqrt_s) {
     checkcp1;
     float fs = get_fpu_register_float(instruction.fr.fs);
-    float root = sqrt(fs);
+    float root;
+    FPU_ARITH(root = sqrt(fs));
     set_fpu_register_float(instruction.fr.fd, root);
 }
 
 MIPS_INSTR(mips_cp_sqrt_d) {
     checkcp1;
     double fs = get_fpu_register_double(instruction.fr.fs);
-    double root = sqrt(fs);
+    double root;
+    FPU_ARITH(root = sqrt(fs));
     set_fpu_register_double(instruction.fr.fd, root);
 }
 
@@ -739,7 +784,7 @@ MIPS_INSTR(mips_ldc1) {
     word physical;
     if (!resolve_virtual_address(address, BUS_LOAD, &physical)) {
         on_tlb_exception(address);
-        r4300i_handle_exception(N64CPU.prev_pc, get_tlb_exception_code(N64CP0.tlb_error, BUS_LOAD), 0);
+        r4300i_handle_exception(r4300i_exception_pc(), get_tlb_exception_code(N64CP0.tlb_error, BUS_LOAD), 0);
     } else {
         dword value = n64_read_physical_dword(physical);
         set_fpu_register_dword(instruction.i.rt, value);
@@ -755,7 +800,7 @@ MIPS_INSTR(mips_sdc1) {
     word physical;
     if (!resolve_virtual_address(address, BUS_LOAD, &physical)) {
         on_tlb_exception(address);
-        r4300i_handle_exception(N64CPU.prev_pc, get_tlb_exception_code(N64CP0.tlb_error, BUS_STORE), 0);
+        r4300i_handle_exception(r4300i_exception_pc(), get_tlb_exception_code(N64CP0.tlb_error, BUS_STORE), 0);
     } else {
         n64_write_physical_dword(physical, value);
     }
@@ -769,7 +814,7 @@ MIPS_INSTR(mips_lwc1) {
     word physical;
     if (!resolve_virtual_address(address, BUS_LOAD, &physical)) {
         on_tlb_exception(address);
-        r4300i_handle_exception(N64CPU.prev_pc, get_tlb_exception_code(N64CP0.tlb_error, BUS_LOAD), 0);
+        r4300i_handle_exception(r4300i_exception_pc(), get_tlb_exception_code(N64CP0.tlb_error, BUS_LOAD), 0);
     } else {
         word value = n64_read_physical_word(physical);
         set_fpu_register_word(instruction.fi.ft, value);
@@ -6,6 +6,7 @@
 #include "mips_instructions.h"
 #include "fpu_instructions.h"
 #include "tlb_instructions.h"
+#include <cpu/dynarec/dynarec.h>
 
 const char* register_names[] = {
         "zero", // 0
@@ -64,6 +65,14 @@ INLINE bool is_xtlb(dword address) {
     }
 }
 
+dword r4300i_exception_pc() {
+    dword pc;
+    if (dynarec_exception_pc(&pc)) {
+        return pc;
+    }
+    return N64CPU.prev_pc;
+}
+
 // pc = pc of the instruction where execution was when the exception was thrown
 void r4300i_handle_exception(dword pc, word code, int coprocessor_error) {
     bool old_exl = N64CP0.status.exl; // used for TLB exceptions since exl is overwritten later
@@ -717,6 +726,10 @@ void r4300i_step() {
     }
      */
 
+    r4300i_step_instruction();
+}
+
+void r4300i_step_instruction() {
     N64CPU.prev_branch = N64CPU.branch;
     N64CPU.branch = false;
 
@@ -747,11 +760,26 @@ void r4300i_step() {
     N64CPU.exception = false; // only used in dynarec
 }
 
+// True when the CPU has just taken a branch to itself with a NOP in the delay slot, so it'll spin until an interrupt.
+bool r4300i_in_idle_loop() {
+    if (!N64CPU.branch || N64CPU.next_pc != N64CPU.pc - 4) {
+        return false;
+    }
+    word physical_pc;
+    if (!resolve_virtual_address(N64CPU.pc, BUS_LOAD, &physical_pc)) {
+        return false;
+    }
+    return n64_read_physical_word(physical_pc) == 0;
+}
+
 void r4300i_interrupt_update() {
     N64CPU.interrupts = N64CPU.cp0.cause.interrupt_pending & N64CPU.cp0.status.im;
 }
 
-bool instruction_stable(mips_instruction_t instr) {
+// known_rdram_access: the compiler has proven that this instruction's memory access, if it has one, is to RDRAM.
+// known_poll_access: the access is a read of a status register that only changes when an event happens, see
+// is_idle_poll_address().
+bool instruction_stable(mips_instruction_t instr, bool known_rdram_access, bool known_poll_access) {
     if (instr.raw == 0) {
         return true; // NOP
     }
@@ -774,7 +802,7 @@ bool instruction_stable(mips_instruction_t instr) {
         case OPC_ORI:
         case OPC_LUI:
             return true;
-        // Loads are stable if they load from RAM
+        // Loads are stable if they load from RAM, or poll a status register
         case OPC_LB:
         case OPC_LBU:
         case OPC_LH:
@@ -786,7 +814,7 @@ bool instruction_stable(mips_instruction_t instr) {
         case OPC_LD:
         case OPC_LDL:
         case OPC_LDR:
-            return false; // TODO need const propagation to properly detect if this is a RAM access
+            return known_rdram_access || known_poll_access;
         // Stores are stable if they store to RAM
         case OPC_SB:
         case OPC_SH:
@@ -796,7 +824,7 @@ bool instruction_stable(mips_instruction_t instr) {
         case OPC_SD:
         case OPC_SDL:
         case OPC_SDR:
-            return false; // TODO need const propagation to properly detect if this is a RAM access
+            return known_rdram_access;
         default:
             return false;
     }
@@ -511,6 +511,9 @@ typedef struct cp0 {
     bool supervisor_mode;
     bool user_mode;
     bool is_64bit_addressing;
+
+    // Bumped whenever a virtual address might translate differently: the TLB, the ASID or the addressing mode changed.
+    word translation_generation;
 } cp0_t;
 
 typedef union fcr0 {
@@ -603,10 +606,16 @@ typedef void(*mipsinstr_handler_t)(mips_instruction_t);
 
 void on_tlb_exception(dword address);
 void r4300i_step();
+// Runs one instruction without advancing COUNT, for callers that keep track of cycles themselves.
+void r4300i_step_instruction();
 void r4300i_handle_exception(dword pc, word code, int coprocessor_error);
+// The PC of the instruction that's running, for handlers raising an exception. That's prev_pc in the interpreter,
+// compiled code doesn't keep it up to date.
+dword r4300i_exception_pc();
 mipsinstr_handler_t r4300i_instruction_decode(dword pc, mips_instruction_t instr);
 void r4300i_interrupt_update();
-bool instruction_stable(mips_instruction_t instr);
+bool r4300i_in_idle_loop();
+bool instruction_stable(mips_instruction_t instr, bool known_rdram_access, bool known_poll_access);
 
 extern const char* register_names[];
 extern const char* cp0_register_names[];
@@ -623,8 +632,22 @@ INLINE void set_pc_dword_r4300i(dword new_pc) {
     N64CPU.next_pc = N64CPU.pc + 4;
 }
 
+INLINE void cp0_translation_changed() {
+    N64CPU.cp0.translation_generation++;
+}
+
+INLINE void cp0_entry_hi_updated(dword old_entry_hi) {
+    cp0_entry_hi_t old = {.raw = old_entry_hi};
+    if (old.asid != N64CPU.cp0.entry_hi.asid) {
+        cp0_translation_changed();
+    }
+}
+
 INLINE void cp0_status_updated() {
     bool exception = N64CPU.cp0.status.exl || N64CPU.cp0.status.erl;
+    bool was_kernel_mode = N64CPU.cp0.kernel_mode;
+    bool was_user_mode = N64CPU.cp0.user_mode;
+    bool was_64bit_addressing = N64CPU.cp0.is_64bit_addressing;
 
     N64CPU.cp0.kernel_mode     =  exception || N64CPU.cp0.status.ksu == CPU_MODE_KERNEL;
     N64CPU.cp0.supervisor_mode = !exception && N64CPU.cp0.status.ksu == CPU_MODE_SUPERVISOR;
@@ -633,6 +656,11 @@ INLINE void cp0_status_updated() {
             (N64CPU.cp0.kernel_mode && N64CPU.cp0.status.kx)
             || (N64CPU.cp0.supervisor_mode && N64CPU.cp0.status.sx)
                || (N64CPU.cp0.user_mode && N64CPU.cp0.status.ux);
+
+    if (was_kernel_mode != N64CPU.cp0.kernel_mode || was_user_mode != N64CPU.cp0.user_mode
+        || was_64bit_addressing != N64CPU.cp0.is_64bit_addressing) {
+        cp0_translation_changed();
+    }
 }
 
 #endif //N64_R4300I_H
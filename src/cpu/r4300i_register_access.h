@@ -82,9 +82,12 @@ INLINE void set_cp0_register_word(byte r, word value) {
         case R4300I_CP0_REG_ENTRYLO1:
             N64CPU.cp0.entry_lo1.raw = value & CP0_ENTRY_LO_WRITE_MASK;
             break;
-        case R4300I_CP0_REG_ENTRYHI:
+        case R4300I_CP0_REG_ENTRYHI: {
+            dword old_entry_hi = N64CPU.cp0.entry_hi.raw;
             N64CPU.cp0.entry_hi.raw = se_32_64(value) & CP0_ENTRY_HI_WRITE_MASK;
+            cp0_entry_hi_updated(old_entry_hi);
             break;
+        }
         case R4300I_CP0_REG_PAGEMASK:
             N64CPU.cp0.page_mask.raw = value & CP0_PAGEMASK_WRITE_MASK;
             break;
@@ -262,9 +265,12 @@ INLINE void set_cp0_register_dword(byte r, dword value) {
             break;
         case R4300I_CP0_REG_COUNT:
             logfatal("Writing CP0 register R4300I_CP0_REG_COUNT as dword!");
-        case R4300I_CP0_REG_ENTRYHI:
+        case R4300I_CP0_REG_ENTRYHI: {
+            dword old_entry_hi = N64CPU.cp0.entry_hi.raw;
             N64CPU.cp0.entry_hi.raw = value & CP0_ENTRY_HI_WRITE_MASK;
+            cp0_entry_hi_updated(old_entry_hi);
             break;
+        }
         case R4300I_CP0_REG_COMPARE:
             logfatal("Writing CP0 register R4300I_CP0_REG_COMPARE as dword!");
         case R4300I_CP0_REG_STATUS:
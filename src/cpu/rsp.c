@@ -354,11 +354,10 @@ void rsp_run() {
 
 void rsp_dynarec_run() {
     int run_for = 0;
-    // This is set to 0 by the break instruction, and when halted by a write to SP_STATUS_REG
+    // Compiled blocks take what they run out of this themselves, and chain into each other until it's used up.
+    // It's also set to 0 by the break instruction, and when halted by a write to SP_STATUS_REG
     while (N64RSP.steps > 0) {
-        int taken = rsp_dynarec_step();
-        N64RSP.steps -= taken;
-        run_for += taken;
+        run_for += rsp_dynarec_step();
     }
     mark_metric_multiple(METRIC_RSP_STEPS, run_for);
 }
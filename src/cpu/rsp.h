@@ -130,7 +130,7 @@ INLINE void quick_invalidate_rsp_icache(word address) {
 
     N64RSP.icache[index].handler = cache_rsp_instruction;
     N64RSP.icache[index].instruction.raw = word_from_byte_array(N64RSP.sp_imem, address);
-    N64RSPDYNAREC->blockcache[index].run = NULL;
+    rsp_dynarec_imem_written(N64RSPDYNAREC);
 }
 
 INLINE void invalidate_rsp_icache(word address) {
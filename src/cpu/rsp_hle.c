@@ -0,0 +1,66 @@
+#include "rsp_hle.h"
+
+#include <log.h>
+#include <mem/mem_util.h>
+#include <system/n64system.h>
+#include <cpu/dynarec/dynarec.h>
+#include "rsp.h"
+#include "rsp_hle_audio.h"
+#include "rsp_hle_gfx.h"
+
+static void read_task(rsp_hle_task_t* task) {
+    word* fields = (word*)task;
+    for (int i = 0; i < sizeof(rsp_hle_task_t) / sizeof(word); i++) {
+        fields[i] = word_from_byte_array(N64RSP.sp_dmem, RSP_HLE_TASK_ADDRESS + i * sizeof(word));
+    }
+}
+
+// What the microcode does when it's done: signal the task is done, and break.
+static void finish_task() {
+    N64RSP.status.signal_2 = true; // SP_STATUS_TASKDONE
+    N64RSP.status.halt = true;
+    N64RSP.status.broke = true;
+    N64RSP.steps = 0;
+
+    if (N64RSP.status.intr_on_break) {
+        interrupt_raise(INTERRUPT_SP);
+    }
+}
+
+bool rsp_hle_run_task() {
+    // Tasks always start at the beginning of IMEM, anything else is the RSP being resumed.
+    if ((N64RSP.pc & 0x3FF) != 0) {
+        return false;
+    }
+
+    rsp_hle_task_t task;
+    read_task(&task);
+
+    bool handled = false;
+    switch (task.type) {
+        case M_GFXTASK:
+            // RDP plugins get their commands through the plugin interface, which HLE can't feed.
+            handled = n64sys.hle_gfx && n64sys.video_type != OPENGL_VIDEO_TYPE && rsp_hle_gfx_task(&task);
+            break;
+        case M_AUDTASK:
+            handled = n64sys.hle_audio && rsp_hle_audio_task(&task);
+            break;
+        default:
+            break;
+    }
+
+    if (handled) {
+        finish_task();
+    }
+    return handled;
+}
+
+void rsp_hle_dram_written(word address, word length) {
+    if (length == 0) {
+        return;
+    }
+    for (word offset = 0; offset < length; offset += BLOCKCACHE_PAGE_SIZE) {
+        invalidate_dynarec_page(address + offset);
+    }
+    invalidate_dynarec_page(address + length - 1);
+}
@@ -0,0 +1,44 @@
+#ifndef N64_RSP_HLE_H
+#define N64_RSP_HLE_H
+
+#include <stdbool.h>
+#include <util.h>
+
+// High level emulation of RSP tasks. Instead of stepping the microcode, the task the OS hands the RSP is read out of
+// DMEM and done in C. This is optional: the results aren't exactly what the microcode would produce, so LLE is still
+// the default.
+
+// The OS copies the OSTask for the task it's starting to the end of DMEM.
+#define RSP_HLE_TASK_ADDRESS 0xFC0
+
+#define M_GFXTASK 1
+#define M_AUDTASK 2
+
+typedef struct rsp_hle_task {
+    word type;
+    word flags;
+    word ucode_boot;
+    word ucode_boot_size;
+    word ucode;
+    word ucode_size;
+    word ucode_data;
+    word ucode_data_size;
+    word dram_stack;
+    word dram_stack_size;
+    word output_buff;
+    word output_buff_size;
+    word data_ptr;
+    word data_size;
+    word yield_data_ptr;
+    word yield_data_size;
+} rsp_hle_task_t;
+
+// Called when the RSP is started. If HLE is enabled for the task it was started with, and the task is one that can be
+// handled, runs it to completion and halts the RSP like the microcode would have. Returns false if the RSP needs to run
+// the task itself.
+bool rsp_hle_run_task();
+
+// RDRAM that HLE code writes to has to go through here, in case there's compiled code in it.
+void rsp_hle_dram_written(word address, word length);
+
+#endif //N64_RSP_HLE_H
@@ -0,0 +1,554 @@
+#include "rsp_hle_audio.h"
+
+#include <log.h>
+#include <mem/mem_util.h>
+#include <system/n64system.h>
+#include "rsp.h"
+
+// The standard audio microcode (ABI1, used by most first party games). Commands work on buffers in DMEM, which the
+// microcode addresses relative to where its buffer space starts, and move data in and out of RDRAM by segmented
+// addresses.
+#define ABI1_DMEM_BASE 0x5C0
+#define ABI1_NUM_SEGMENTS 16
+
+// Command flags
+#define A_INIT 0x01
+#define A_LOOP 0x02
+#define A_LEFT 0x02
+#define A_VOL  0x04
+#define A_AUX  0x08
+
+typedef struct abi1_state {
+    word segments[ABI1_NUM_SEGMENTS];
+
+    // SETBUFF
+    half in;
+    half out;
+    half count;
+    half dry_right;
+    half wet_left;
+    half wet_right;
+
+    // SETVOL
+    shalf vol[2];
+    shalf target[2];
+    sword rate[2];
+    shalf dry;
+    shalf wet;
+
+    word adpcm_loop;
+    shalf adpcm_table[16 * 16]; // 16 predictors of 2 * 8 coefficients
+} abi1_state_t;
+
+static abi1_state_t abi1;
+
+INLINE half align_up(half value, half alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+INLINE shalf clamp_s16(sword value) {
+    if (value > 32767) {
+        return 32767;
+    } else if (value < -32768) {
+        return -32768;
+    }
+    return value;
+}
+
+// DMEM and RDRAM are stored a word at a time in host order, so samples are accessed through HALF_ADDRESS().
+INLINE shalf* dmem_s16(half address) {
+    return (shalf*)&N64RSP.sp_dmem[HALF_ADDRESS(address & 0xFFE)];
+}
+
+INLINE byte* dmem_u8(half address) {
+    return &N64RSP.sp_dmem[BYTE_ADDRESS(address & 0xFFF)];
+}
+
+INLINE shalf* dram_s16(word address) {
+    return (shalf*)&n64sys.mem.rdram[HALF_ADDRESS(address & (N64_RDRAM_SIZE - 2))];
+}
+
+INLINE word segmented_address(word address) {
+    word segment = (address >> 24) & 0x3F;
+    word offset = address & 0xFFFFFF;
+    if (segment >= ABI1_NUM_SEGMENTS) {
+        logwarn("HLE audio: segment %d out of range", segment);
+        return offset;
+    }
+    return abi1.segments[segment] + offset;
+}
+
+// Copies between DMEM and RDRAM like the microcode's DMAs do, word aligned in DMEM and 8 byte aligned in RDRAM. Both
+// use the same layout, so that's a plain copy.
+static void dma_to_dmem(half dmem, word dram, half length) {
+    dmem &= 0xFFC;
+    dram &= 0xFFFFF8;
+    length = align_up(length, 8);
+    if (dmem + length > SP_DMEM_SIZE) {
+        length = SP_DMEM_SIZE - dmem;
+    }
+    if (dram + length > N64_RDRAM_SIZE) {
+        return;
+    }
+    memcpy(&N64RSP.sp_dmem[dmem], &n64sys.mem.rdram[dram], length);
+}
+
+static void dma_to_dram(word dram, half dmem, half length) {
+    dmem &= 0xFFC;
+    dram &= 0xFFFFF8;
+    length = align_up(length, 8);
+    if (dmem + length > SP_DMEM_SIZE) {
+        length = SP_DMEM_SIZE - dmem;
+    }
+    if (dram + length > N64_RDRAM_SIZE) {
+        return;
+    }
+    memcpy(&n64sys.mem.rdram[dram], &N64RSP.sp_dmem[dmem], length);
+    rsp_hle_dram_written(dram, length);
+}
+
+// dst += src * gain, where gain is Q1.15
+INLINE void sample_mix(shalf* dst, shalf src, shalf gain) {
+    *dst = clamp_s16(*dst + ((src * gain) >> 15));
+}
+
+static void mix(half dmemo, half dmemi, half count, shalf gain) {
+    int samples = count >> 1;
+    int i = 0;
+#ifdef N64_USE_SIMD
+    // Both buffers have their samples swapped around the same way as long as they're word aligned, so whole vectors
+    // can be mixed at once.
+    if (((dmemo | dmemi) & 3) == 0 && dmemo + count <= SP_DMEM_SIZE && dmemi + count <= SP_DMEM_SIZE) {
+        __m128i gains = _mm_set1_epi16(gain);
+        for (; i + 8 <= samples; i += 8) {
+            __m128i* dst = (__m128i*)&N64RSP.sp_dmem[dmemo + i * 2];
+            __m128i src = _mm_loadu_si128((__m128i*)&N64RSP.sp_dmem[dmemi + i * 2]);
+            __m128i dst_samples = _mm_loadu_si128(dst);
+
+            // Full 32 bit products, so the shift and the add can't wrap before the final clamp
+            __m128i lo = _mm_mullo_epi16(src, gains);
+            __m128i hi = _mm_mulhi_epi16(src, gains);
+            __m128i products_lo = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15);
+            __m128i products_hi = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15);
+            __m128i dst_lo = _mm_srai_epi32(_mm_unpacklo_epi16(dst_samples, dst_samples), 16);
+            __m128i dst_hi = _mm_srai_epi32(_mm_unpackhi_epi16(dst_samples, dst_samples), 16);
+
+            _mm_storeu_si128(dst, _mm_packs_epi32(_mm_add_epi32(dst_lo, products_lo), _mm_add_epi32(dst_hi, products_hi)));
+        }
+    }
+#endif
+    for (; i < samples; i++) {
+        sample_mix(dmem_s16(dmemo + i * 2), *dmem_s16(dmemi + i * 2), gain);
+    }
+}
+
+// Resampling filter taps for each of the 64 fractional positions between two samples, from the microcode's data. It's
+// found by its first taps, since where it is depends on the version of the microcode.
+static const half resample_lut_signature[4] = { 0x0C39, 0x66AD, 0x0D46, 0xFFDF };
+static shalf resample_lut[64 * 4];
+static bool resample_lut_loaded = false;
+static word resample_lut_ucode_data;
+
+static bool load_resample_lut(const rsp_hle_task_t* task) {
+    word data = task->ucode_data & 0xFFFFFF;
+    if (resample_lut_loaded && resample_lut_ucode_data == data) {
+        return true;
+    }
+    word size = task->ucode_data_size < SP_DMEM_SIZE ? task->ucode_data_size : SP_DMEM_SIZE;
+    for (word offset = 0; offset + sizeof(resample_lut) <= size; offset += 8) {
+        bool found = true;
+        for (int i = 0; i < 4 && found; i++) {
+            found = (half)*dram_s16(data + offset + i * 2) == resample_lut_signature[i];
+        }
+        if (found) {
+            for (int i = 0; i < 64 * 4; i++) {
+                resample_lut[i] = *dram_s16(data + offset + i * 2);
+            }
+            resample_lut_loaded = true;
+            resample_lut_ucode_data = data;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Samples are addressed by index here, and wrap around DMEM.
+INLINE shalf* resample_sample(int index) {
+    return dmem_s16(index << 1);
+}
+
+// pitch is Q16.16. The four samples before the input and the position between samples are saved to RDRAM so the next
+// task can carry on from them.
+static void resample(bool init, half dmemo, half dmemi, half count, word pitch, word address) {
+    int ipos = (dmemi >> 1) - 4;
+    int opos = dmemo >> 1;
+    word pitch_accu;
+
+    if (init) {
+        for (int i = 0; i < 4; i++) {
+            *resample_sample(ipos + i) = 0;
+        }
+        pitch_accu = 0;
+    } else {
+        for (int i = 0; i < 4; i++) {
+            *resample_sample(ipos + i) = *dram_s16(address + i * 2);
+        }
+        pitch_accu = (half)*dram_s16(address + 8);
+    }
+
+    for (int i = 0; i < count >> 1; i++) {
+        const shalf* lut = &resample_lut[(pitch_accu & 0xFC00) >> 8];
+        sword accu = *resample_sample(ipos) * lut[0]
+                     + *resample_sample(ipos + 1) * lut[1]
+                     + *resample_sample(ipos + 2) * lut[2]
+                     + *resample_sample(ipos + 3) * lut[3];
+        *resample_sample(opos++) = clamp_s16(accu >> 15);
+
+        pitch_accu += pitch;
+        ipos += pitch_accu >> 16;
+        pitch_accu &= 0xFFFF;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        *dram_s16(address + i * 2) = *resample_sample(ipos + i);
+    }
+    *dram_s16(address + 8) = pitch_accu;
+    rsp_hle_dram_written(address, 10);
+}
+
+// ADPCM frames are a header byte (the scale and which predictor to use) followed by 16 4 bit residuals.
+static void adpcm_predict_frame(shalf* frame, half dmemi, int scale) {
+    int rshift = scale < 12 ? 12 - scale : 0;
+    for (int i = 0; i < 8; i++) {
+        byte b = *dmem_u8(dmemi + i);
+        frame[i * 2] = (shalf)((b & 0xF0) << 8) >> rshift;
+        frame[i * 2 + 1] = (shalf)((b & 0x0F) << 12) >> rshift;
+    }
+}
+
+static void adpcm_compute_residuals(shalf* dst, const shalf* src, const shalf* predictor, shalf last1, shalf last2) {
+    const shalf* book1 = predictor;
+    const shalf* book2 = predictor + 8;
+    for (int i = 0; i < 8; i++) {
+        sword accu = (sword)src[i] << 11;
+        accu += book1[i] * last1 + book2[i] * last2;
+        for (int j = 0; j < i; j++) {
+            accu += book2[j] * src[i - 1 - j];
+        }
+        dst[i] = clamp_s16(accu >> 11);
+    }
+}
+
+static void adpcm(bool init, bool loop, half dmemo, half dmemi, half count, word address) {
+    shalf last_frame[16];
+
+    if (init) {
+        memset(last_frame, 0, sizeof(last_frame));
+    } else {
+        word from = loop ? abi1.adpcm_loop : address;
+        for (int i = 0; i < 16; i++) {
+            last_frame[i] = *dram_s16(from + i * 2);
+        }
+    }
+
+    // The output starts with the end of the previous frame, for the resampler to work from.
+    for (int i = 0; i < 16; i++, dmemo += 2) {
+        *dmem_s16(dmemo) = last_frame[i];
+    }
+
+    for (; count > 0; count -= 32) {
+        byte code = *dmem_u8(dmemi++);
+        const shalf* predictor = &abi1.adpcm_table[(code & 0xF) << 4];
+        shalf frame[16];
+
+        adpcm_predict_frame(frame, dmemi, code >> 4);
+        dmemi += 8;
+
+        adpcm_compute_residuals(&last_frame[0], &frame[0], predictor, last_frame[14], last_frame[15]);
+        adpcm_compute_residuals(&last_frame[8], &frame[8], predictor, last_frame[6], last_frame[7]);
+
+        for (int i = 0; i < 16; i++, dmemo += 2) {
+            *dmem_s16(dmemo) = last_frame[i];
+        }
+    }
+
+    for (int i = 0; i < 16; i++) {
+        *dram_s16(address + i * 2) = last_frame[i];
+    }
+    rsp_hle_dram_written(address, 32);
+}
+
+typedef struct volume_ramp {
+    sword value;
+    sword target;
+    sword step;
+} volume_ramp_t;
+
+INLINE shalf ramp_step(volume_ramp_t* ramp) {
+    ramp->value += ramp->step;
+    bool reached = ramp->step <= 0 ? ramp->value <= ramp->target : ramp->value >= ramp->target;
+    if (reached) {
+        ramp->value = ramp->target;
+        ramp->step = 0;
+    }
+    return ramp->value >> 16;
+}
+
+// Where ENVMIXER keeps its state between tasks, in words
+#define ENVMIX_SAVE_WET       0
+#define ENVMIX_SAVE_DRY       1
+#define ENVMIX_SAVE_TARGET    2
+#define ENVMIX_SAVE_EXP_RATE  4
+#define ENVMIX_SAVE_EXP_SEQ   6
+#define ENVMIX_SAVE_VALUE     8
+#define ENVMIX_SAVE_WORDS     10
+
+// Applies the left and right volumes to a mono voice, ramping them towards their targets on an exponential curve, and
+// mixes it into the dry and (with A_AUX) wet buffers.
+static void envmixer(bool init, bool aux, word address) {
+    volume_ramp_t ramps[2];
+    sword exp_seq[2];
+    sword exp_rates[2];
+    shalf dry = abi1.dry;
+    shalf wet = abi1.wet;
+
+    if (init) {
+        for (int i = 0; i < 2; i++) {
+            ramps[i].value = abi1.vol[i] << 16;
+            ramps[i].target = abi1.target[i] << 16;
+            exp_rates[i] = abi1.rate[i] >> 16;
+            exp_seq[i] = abi1.vol[i] * (abi1.rate[i] & 0xFFFF);
+        }
+    } else {
+        wet = RDRAM_WORD(address + ENVMIX_SAVE_WET * 4);
+        dry = RDRAM_WORD(address + ENVMIX_SAVE_DRY * 4);
+        for (int i = 0; i < 2; i++) {
+            ramps[i].target = RDRAM_WORD(address + (ENVMIX_SAVE_TARGET + i) * 4);
+            exp_rates[i] = RDRAM_WORD(address + (ENVMIX_SAVE_EXP_RATE + i) * 4);
+            exp_seq[i] = RDRAM_WORD(address + (ENVMIX_SAVE_EXP_SEQ + i) * 4);
+            ramps[i].value = RDRAM_WORD(address + (ENVMIX_SAVE_VALUE + i) * 4);
+        }
+    }
+
+    // Only ramps that haven't reached their targets move
+    for (int i = 0; i < 2; i++) {
+        ramps[i].step = ramps[i].target - ramps[i].value;
+    }
+
+    half buffers[4] = { abi1.out, abi1.dry_right, abi1.wet_left, abi1.wet_right };
+    int num_buffers = aux ? 4 : 2;
+    int sample = 0;
+
+    for (int y = 0; y < abi1.count; y += 16) {
+        for (int i = 0; i < 2; i++) {
+            if (ramps[i].step != 0) {
+                exp_seq[i] = ((sdword)exp_seq[i] * (sdword)exp_rates[i]) >> 16;
+                ramps[i].step = (exp_seq[i] - ramps[i].value) >> 3;
+            }
+        }
+
+        for (int x = 0; x < 8; x++, sample++) {
+            shalf left = ramp_step(&ramps[0]);
+            shalf right = ramp_step(&ramps[1]);
+            shalf gains[4] = {
+                    clamp_s16((left * dry + 0x4000) >> 15),
+                    clamp_s16((right * dry + 0x4000) >> 15),
+                    clamp_s16((left * wet + 0x4000) >> 15),
+                    clamp_s16((right * wet + 0x4000) >> 15)
+            };
+            shalf in = *dmem_s16(abi1.in + sample * 2);
+            for (int i = 0; i < num_buffers; i++) {
+                sample_mix(dmem_s16(buffers[i] + sample * 2), in, gains[i]);
+            }
+        }
+    }
+
+    RDRAM_WORD(address + ENVMIX_SAVE_WET * 4) = wet;
+    RDRAM_WORD(address + ENVMIX_SAVE_DRY * 4) = dry;
+    for (int i = 0; i < 2; i++) {
+        RDRAM_WORD(address + (ENVMIX_SAVE_TARGET + i) * 4) = ramps[i].target;
+        RDRAM_WORD(address + (ENVMIX_SAVE_EXP_RATE + i) * 4) = exp_rates[i];
+        RDRAM_WORD(address + (ENVMIX_SAVE_EXP_SEQ + i) * 4) = exp_seq[i];
+        RDRAM_WORD(address + (ENVMIX_SAVE_VALUE + i) * 4) = ramps[i].value;
+    }
+    rsp_hle_dram_written(address, ENVMIX_SAVE_WORDS * 4);
+}
+
+// Left and right buffers into one buffer of alternating samples, for the AI.
+static void interleave(half dmemo, half left, half right, half count) {
+    for (int i = 0; i < count >> 1; i++) {
+        shalf l = *dmem_s16(left + i * 2);
+        shalf r = *dmem_s16(right + i * 2);
+        *dmem_s16(dmemo + i * 4) = l;
+        *dmem_s16(dmemo + i * 4 + 2) = r;
+    }
+}
+
+typedef enum abi1_command {
+    ABI1_SPNOOP,
+    ABI1_ADPCM,
+    ABI1_CLEARBUFF,
+    ABI1_ENVMIXER,
+    ABI1_LOADBUFF,
+    ABI1_RESAMPLE,
+    ABI1_SAVEBUFF,
+    ABI1_SEGMENT,
+    ABI1_SETBUFF,
+    ABI1_SETVOL,
+    ABI1_DMEMMOVE,
+    ABI1_LOADADPCM,
+    ABI1_MIXER,
+    ABI1_INTERLEAVE,
+    ABI1_POLEF,
+    ABI1_SETLOOP
+} abi1_command_t;
+
+static void abi1_command(word w1, word w2) {
+    byte flags = (w1 >> 16) & 0xFF;
+    switch ((w1 >> 24) & 0x7F) {
+        case ABI1_SPNOOP:
+            break;
+        case ABI1_ADPCM:
+            adpcm(flags & A_INIT, flags & A_LOOP, abi1.out, abi1.in, align_up(abi1.count, 32), segmented_address(w2));
+            break;
+        case ABI1_CLEARBUFF: {
+            half dmem = (w1 & 0xFFFF) + ABI1_DMEM_BASE;
+            half count = align_up(w2 & 0xFFFF, 16);
+            for (half i = 0; i < count; i++) {
+                *dmem_u8(dmem + i) = 0;
+            }
+            break;
+        }
+        case ABI1_ENVMIXER:
+            envmixer(flags & A_INIT, flags & A_AUX, segmented_address(w2));
+            break;
+        case ABI1_LOADBUFF:
+            if (abi1.count != 0) {
+                dma_to_dmem(abi1.in, segmented_address(w2), abi1.count);
+            }
+            break;
+        case ABI1_RESAMPLE:
+            resample(flags & A_INIT, abi1.out, abi1.in, align_up(abi1.count, 16), (w1 & 0xFFFF) << 1, segmented_address(w2));
+            break;
+        case ABI1_SAVEBUFF:
+            if (abi1.count != 0) {
+                dma_to_dram(segmented_address(w2), abi1.out, abi1.count);
+            }
+            break;
+        case ABI1_SEGMENT:
+            abi1.segments[(w2 >> 24) & 0xF] = w2 & 0xFFFFFF;
+            break;
+        case ABI1_SETBUFF:
+            if (flags & A_AUX) {
+                abi1.dry_right = (w1 & 0xFFFF) + ABI1_DMEM_BASE;
+                abi1.wet_left = (w2 >> 16) + ABI1_DMEM_BASE;
+                abi1.wet_right = (w2 & 0xFFFF) + ABI1_DMEM_BASE;
+            } else {
+                abi1.in = (w1 & 0xFFFF) + ABI1_DMEM_BASE;
+                abi1.out = (w2 >> 16) + ABI1_DMEM_BASE;
+                abi1.count = w2 & 0xFFFF;
+            }
+            break;
+        case ABI1_SETVOL:
+            if (flags & A_VOL) {
+                if (flags & A_LEFT) {
+                    abi1.vol[0] = w1 & 0xFFFF;
+                    abi1.dry = w2 >> 16;
+                    abi1.wet = w2 & 0xFFFF;
+                } else {
+                    abi1.vol[1] = w1 & 0xFFFF;
+                }
+            } else {
+                int side = (flags & A_LEFT) ? 0 : 1;
+                abi1.target[side] = w1 & 0xFFFF;
+                abi1.rate[side] = w2;
+            }
+            break;
+        case ABI1_DMEMMOVE: {
+            half dmemi = (w1 & 0xFFFF) + ABI1_DMEM_BASE;
+            half dmemo = (w2 >> 16) + ABI1_DMEM_BASE;
+            half count = align_up(w2 & 0xFFFF, 16);
+            // A byte at a time, since the microcode's copies can overlap
+            for (half i = 0; i < count; i++) {
+                *dmem_u8(dmemo + i) = *dmem_u8(dmemi + i);
+            }
+            break;
+        }
+        case ABI1_LOADADPCM: {
+            word address = segmented_address(w2);
+            int count = align_up(w1 & 0xFFFF, 8) >> 1;
+            if (count > sizeof(abi1.adpcm_table) / sizeof(shalf)) {
+                count = sizeof(abi1.adpcm_table) / sizeof(shalf);
+            }
+            for (int i = 0; i < count; i++) {
+                abi1.adpcm_table[i] = *dram_s16(address + i * 2);
+            }
+            break;
+        }
+        case ABI1_MIXER:
+            if (abi1.count != 0) {
+                mix((w2 & 0xFFFF) + ABI1_DMEM_BASE, (w2 >> 16) + ABI1_DMEM_BASE, align_up(abi1.count, 32), w1 & 0xFFFF);
+            }
+            break;
+        case ABI1_INTERLEAVE:
+            if (abi1.count != 0) {
+                interleave(abi1.out, (w2 >> 16) + ABI1_DMEM_BASE, (w2 & 0xFFFF) + ABI1_DMEM_BASE, align_up(abi1.count, 16));
+            }
+            break;
+        case ABI1_POLEF:
+            logfatal("HLE audio: POLEF should have sent the task to the RSP"); // See rsp_hle_audio_task()
+        case ABI1_SETLOOP:
+            abi1.adpcm_loop = segmented_address(w2);
+            break;
+        default:
+            logwarn("HLE audio: unknown ABI1 command 0x%02X", (w1 >> 24) & 0x7F);
+            break;
+    }
+}
+
+// The microcode's data segment starts with a few words that tell the different audio microcodes apart.
+static bool is_abi1(const rsp_hle_task_t* task) {
+    word data = task->ucode_data & 0xFFFFFF;
+    return RDRAM_WORD(data) == 0x00000001
+        && RDRAM_WORD(data + 0x30) == 0xF0000F00
+        && RDRAM_WORD(data + 0x28) == 0x1E24138C;
+}
+
+bool rsp_hle_audio_task(const rsp_hle_task_t* task) {
+    if (!is_abi1(task)) {
+        static word last_unknown = 0;
+        if (task->ucode_data != last_unknown) {
+            logwarn("HLE audio: unsupported audio microcode (data at 0x%08X), running it on the RSP instead", task->ucode_data);
+            last_unknown = task->ucode_data;
+        }
+        return false;
+    }
+    if (!load_resample_lut(task)) {
+        static word last_missing = 0;
+        if (task->ucode_data != last_missing) {
+            logwarn("HLE audio: no resampling table in the microcode's data at 0x%08X, running it on the RSP instead", task->ucode_data);
+            last_missing = task->ucode_data;
+        }
+        return false;
+    }
+
+    word list_start = task->data_ptr & 0xFFFFFF;
+    word list_end = list_start + (task->data_size & ~7);
+    // POLEF isn't implemented, and has to be found before anything else runs for the RSP to take over.
+    for (word list = list_start; list < list_end; list += 8) {
+        if (((RDRAM_WORD(list) >> 24) & 0x7F) == ABI1_POLEF) {
+            static bool warned = false;
+            if (!warned) {
+                logwarn("HLE audio: POLEF is not implemented, running audio lists that use it on the RSP instead");
+                warned = true;
+            }
+            return false;
+        }
+    }
+
+    memset(abi1.segments, 0, sizeof(abi1.segments));
+    for (word list = list_start; list < list_end; list += 8) {
+        abi1_command(RDRAM_WORD(list), RDRAM_WORD(list + 4));
+    }
+    return true;
+}
@@ -0,0 +1,10 @@
+#ifndef N64_RSP_HLE_AUDIO_H
+#define N64_RSP_HLE_AUDIO_H
+
+#include "rsp_hle.h"
+
+// Runs an audio task's command list, if it's for a microcode that's supported and only uses commands that are. Returns
+// false if it doesn't, without running any of it.
+bool rsp_hle_audio_task(const rsp_hle_task_t* task);
+
+#endif //N64_RSP_HLE_AUDIO_H
@@ -0,0 +1,1336 @@
+#include "rsp_hle_gfx.h"
+
+#include <math.h>
+#include <string.h>
+#include <log.h>
+#include <mem/mem_util.h>
+#include <system/n64system.h>
+#include <rdp/rdp.h>
+#include "rsp.h"
+
+// The Fast3D family of graphics microcodes. They all do the same job - walk a display list, transform and light
+// vertices, clip and set up triangles, and pass RDP commands through - but the command encodings moved around between
+// generations:
+//   Fast3D (F3D):   the original, 16 vertex buffer
+//   F3DEX 1.x:      same command numbers as F3D, 32 vertex buffer, TRI2/QUAD/BRANCH_Z
+//   F3DEX2 (2.x):   renumbered commands, geometry mode bits moved
+typedef enum gfx_ucode {
+    GFX_UCODE_UNKNOWN,
+    GFX_UCODE_F3D,
+    GFX_UCODE_F3DEX,
+    GFX_UCODE_F3DEX2
+} gfx_ucode_t;
+
+#define GFX_NUM_SEGMENTS 16
+#define GFX_DL_STACK_SIZE 18
+#define GFX_MATRIX_STACK_SIZE 32
+#define GFX_MAX_VERTICES 64
+#define GFX_MAX_LIGHTS 8
+#define GFX_MAX_CLIPPED_VERTICES 16
+// Just in case a display list loops forever
+#define GFX_MAX_COMMANDS 0x100000
+
+// Geometry mode bits that differ between F3D/F3DEX and F3DEX2
+typedef struct gfx_geometry_bits {
+    word zbuffer;
+    word shade;
+    word cull_front;
+    word cull_back;
+    word fog;
+    word lighting;
+    word texture_gen;
+    word texture_gen_linear;
+    word shading_smooth;
+} gfx_geometry_bits_t;
+
+static const gfx_geometry_bits_t f3d_geometry_bits = {
+        .zbuffer = 0x1, .shade = 0x4, .cull_front = 0x1000, .cull_back = 0x2000, .fog = 0x10000, .lighting = 0x20000,
+        .texture_gen = 0x40000, .texture_gen_linear = 0x80000, .shading_smooth = 0x200
+};
+
+static const gfx_geometry_bits_t f3dex2_geometry_bits = {
+        .zbuffer = 0x1, .shade = 0x4, .cull_front = 0x200, .cull_back = 0x400, .fog = 0x10000, .lighting = 0x20000,
+        .texture_gen = 0x40000, .texture_gen_linear = 0x80000, .shading_smooth = 0x200000
+};
+
+// Other mode bits
+#define G_MDSFT_TEXTPERSP 19
+
+// Which clip planes a vertex is outside of
+#define CLIP_NEAR  0x01
+#define CLIP_FAR   0x02
+#define CLIP_X_NEG 0x04
+#define CLIP_X_POS 0x08
+#define CLIP_Y_NEG 0x10
+#define CLIP_Y_POS 0x20
+// Triangles only get clipped against these, the RDP can draw anything that's within the guard band.
+#define CLIP_PLANES (CLIP_NEAR | CLIP_X_NEG | CLIP_X_POS | CLIP_Y_NEG | CLIP_Y_POS)
+
+// Row vector convention, like the microcode: v' = v * m
+typedef struct gfx_matrix {
+    float m[4][4] __attribute__((aligned(16)));
+} gfx_matrix_t;
+
+typedef struct gfx_light {
+    float color[3];
+    float direction[3];
+    float model_direction[3]; // direction in model space, for the current modelview matrix
+} gfx_light_t;
+
+typedef struct gfx_vertex {
+    float position[4]; // clip space
+    float color[4];    // 0-255
+    float texcoord[2]; // s10.5
+    byte clip;
+} gfx_vertex_t;
+
+typedef struct gfx_screen_vertex {
+    float x;
+    float y;
+    float z;      // RDP Z, 0-0x7FFF
+    float inv_w;
+    float color[4];
+    float texcoord[2];
+} gfx_screen_vertex_t;
+
+static struct {
+    gfx_ucode_t ucode;
+    const gfx_geometry_bits_t* geometry_bits;
+
+    word pc;
+    bool running;
+    bool loaded_ucode; // The display list switched microcodes, see gfx_load_ucode()
+    word dl_stack[GFX_DL_STACK_SIZE];
+    int dl_depth;
+    word segments[GFX_NUM_SEGMENTS];
+
+    gfx_matrix_t modelview[GFX_MATRIX_STACK_SIZE];
+    int modelview_depth;
+    gfx_matrix_t projection;
+    gfx_matrix_t mvp;
+    bool mvp_dirty;
+
+    gfx_light_t lights[GFX_MAX_LIGHTS];
+    int num_lights; // directional lights, the ambient light comes after them
+    float lookat[2][3];
+    float model_lookat[2][3];
+    bool lights_dirty;
+
+    float viewport_scale[3];
+    float viewport_translate[3];
+    float clip_ratio;
+    float fog_multiplier;
+    float fog_offset;
+
+    word geometry_mode;
+    word othermode_h;
+    word othermode_l;
+
+    struct {
+        bool on;
+        byte tile;
+        byte level;
+        float scale_s;
+        float scale_t;
+    } texture;
+
+    word rdphalf_1;
+
+    gfx_vertex_t vertices[GFX_MAX_VERTICES];
+} gfx;
+
+INLINE half rdram_half(word address) {
+    return *(half*)&n64sys.mem.rdram[HALF_ADDRESS(address & (N64_RDRAM_SIZE - 2))];
+}
+
+INLINE word segmented_address(word address) {
+    return (gfx.segments[(address >> 24) & 0xF] + (address & 0xFFFFFF)) & 0xFFFFFF;
+}
+
+static void warn_unsupported(byte command, const char* name) {
+    static bool warned[256];
+    if (!warned[command]) {
+        logwarn("HLE graphics: %s (command 0x%02X) isn't supported, skipping it", name, command);
+        warned[command] = true;
+    }
+}
+
+// ----- Matrices -----
+
+static void matrix_identity(gfx_matrix_t* m) {
+    memset(m, 0, sizeof(gfx_matrix_t));
+    for (int i = 0; i < 4; i++) {
+        m->m[i][i] = 1.0f;
+    }
+}
+
+// Matrices in RDRAM are s15.16, all the integer parts followed by all the fractional parts.
+static void matrix_load(gfx_matrix_t* m, word address) {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            word element = (i * 4 + j) * 2;
+            sword fixed = (rdram_half(address + element) << 16) | rdram_half(address + 32 + element);
+            m->m[i][j] = fixed / 65536.0f;
+        }
+    }
+}
+
+// dst = a * b, safe for dst to be either of them
+static void matrix_multiply(gfx_matrix_t* dst, const gfx_matrix_t* a, const gfx_matrix_t* b) {
+    gfx_matrix_t result;
+#ifdef N64_USE_SIMD
+    __m128 b0 = _mm_load_ps(b->m[0]);
+    __m128 b1 = _mm_load_ps(b->m[1]);
+    __m128 b2 = _mm_load_ps(b->m[2]);
+    __m128 b3 = _mm_load_ps(b->m[3]);
+    for (int i = 0; i < 4; i++) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a->m[i][0]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->m[i][1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->m[i][2]), b2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->m[i][3]), b3));
+        _mm_store_ps(result.m[i], row);
+    }
+#else
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            result.m[i][j] = a->m[i][0] * b->m[0][j] + a->m[i][1] * b->m[1][j]
+                           + a->m[i][2] * b->m[2][j] + a->m[i][3] * b->m[3][j];
+        }
+    }
+#endif
+    *dst = result;
+}
+
+INLINE void transform_point(float* out, const gfx_matrix_t* m, float x, float y, float z) {
+#ifdef N64_USE_SIMD
+    __m128 result = _mm_mul_ps(_mm_set1_ps(x), _mm_load_ps(m->m[0]));
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(y), _mm_load_ps(m->m[1])));
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(z), _mm_load_ps(m->m[2])));
+    result = _mm_add_ps(result, _mm_load_ps(m->m[3]));
+    _mm_storeu_ps(out, result);
+#else
+    for (int i = 0; i < 4; i++) {
+        out[i] = x * m->m[0][i] + y * m->m[1][i] + z * m->m[2][i] + m->m[3][i];
+    }
+#endif
+}
+
+INLINE void normalize(float* v) {
+    float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if (length > 0.0f) {
+        v[0] /= length;
+        v[1] /= length;
+        v[2] /= length;
+    }
+}
+
+INLINE float dot3(const float* a, const float* b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Takes a direction into model space (through the transpose of the modelview), so it can be dotted with vertex
+// normals without transforming every normal.
+static void direction_to_model_space(float* out, const float* direction) {
+    const gfx_matrix_t* m = &gfx.modelview[gfx.modelview_depth];
+    for (int i = 0; i < 3; i++) {
+        out[i] = direction[0] * m->m[i][0] + direction[1] * m->m[i][1] + direction[2] * m->m[i][2];
+    }
+    normalize(out);
+}
+
+static void update_matrices() {
+    if (gfx.mvp_dirty) {
+        matrix_multiply(&gfx.mvp, &gfx.modelview[gfx.modelview_depth], &gfx.projection);
+        gfx.mvp_dirty = false;
+    }
+    if (gfx.lights_dirty) {
+        for (int i = 0; i <= gfx.num_lights; i++) {
+            direction_to_model_space(gfx.lights[i].model_direction, gfx.lights[i].direction);
+        }
+        for (int i = 0; i < 2; i++) {
+            direction_to_model_space(gfx.model_lookat[i], gfx.lookat[i]);
+        }
+        gfx.lights_dirty = false;
+    }
+}
+
+static void modelview_changed() {
+    gfx.mvp_dirty = true;
+    gfx.lights_dirty = true;
+}
+
+static void gfx_matrix(word address, bool projection, bool load, bool push) {
+    gfx_matrix_t m;
+    matrix_load(&m, segmented_address(address));
+
+    if (projection) {
+        if (load) {
+            gfx.projection = m;
+        } else {
+            matrix_multiply(&gfx.projection, &m, &gfx.projection);
+        }
+        gfx.mvp_dirty = true;
+        return;
+    }
+
+    if (push) {
+        if (gfx.modelview_depth + 1 >= GFX_MATRIX_STACK_SIZE) {
+            logwarn("HLE graphics: modelview matrix stack overflow");
+        } else {
+            gfx.modelview[gfx.modelview_depth + 1] = gfx.modelview[gfx.modelview_depth];
+            gfx.modelview_depth++;
+        }
+    }
+    if (load) {
+        gfx.modelview[gfx.modelview_depth] = m;
+    } else {
+        matrix_multiply(&gfx.modelview[gfx.modelview_depth], &m, &gfx.modelview[gfx.modelview_depth]);
+    }
+    modelview_changed();
+}
+
+static void gfx_pop_matrix(int count) {
+    if (count > gfx.modelview_depth) {
+        count = gfx.modelview_depth;
+    }
+    gfx.modelview_depth -= count;
+    modelview_changed();
+}
+
+// Replaces the combined matrix until the next matrix command
+static void gfx_force_matrix(word address) {
+    matrix_load(&gfx.mvp, segmented_address(address));
+    gfx.mvp_dirty = false;
+}
+
+// ----- Lights and viewport -----
+
+static void gfx_light(int index, word address) {
+    if (index < 0 || index >= GFX_MAX_LIGHTS) {
+        return;
+    }
+    address = segmented_address(address);
+    gfx_light_t* light = &gfx.lights[index];
+    for (int i = 0; i < 3; i++) {
+        light->color[i] = RDRAM_BYTE(address + i);
+        light->direction[i] = (sbyte)RDRAM_BYTE(address + 8 + i);
+    }
+    gfx.lights_dirty = true;
+}
+
+static void gfx_light_color(int index, word color) {
+    if (index < 0 || index >= GFX_MAX_LIGHTS) {
+        return;
+    }
+    gfx.lights[index].color[0] = (color >> 24) & 0xFF;
+    gfx.lights[index].color[1] = (color >> 16) & 0xFF;
+    gfx.lights[index].color[2] = (color >> 8) & 0xFF;
+}
+
+static void gfx_lookat(int index, word address) {
+    address = segmented_address(address);
+    for (int i = 0; i < 3; i++) {
+        gfx.lookat[index][i] = (sbyte)RDRAM_BYTE(address + 8 + i);
+    }
+    gfx.lights_dirty = true;
+}
+
+static void gfx_num_lights(int num_lights) {
+    if (num_lights < 0) {
+        num_lights = 0;
+    } else if (num_lights >= GFX_MAX_LIGHTS) {
+        num_lights = GFX_MAX_LIGHTS - 1;
+    }
+    gfx.num_lights = num_lights;
+    gfx.lights_dirty = true;
+}
+
+// Scale and translation, x and y in s13.2 pixels, z in the 0-0x3FF depth range
+static void gfx_viewport(word address) {
+    address = segmented_address(address);
+    for (int i = 0; i < 3; i++) {
+        float divisor = i < 2 ? 4.0f : 1.0f;
+        gfx.viewport_scale[i] = (shalf)rdram_half(address + i * 2) / divisor;
+        gfx.viewport_translate[i] = (shalf)rdram_half(address + 8 + i * 2) / divisor;
+    }
+}
+
+// ----- Vertices -----
+
+INLINE float clamp_float(float value, float min, float max) {
+    return value < min ? min : (value > max ? max : value);
+}
+
+static void light_vertex(gfx_vertex_t* vertex, float* normal) {
+    const gfx_light_t* ambient = &gfx.lights[gfx.num_lights];
+    float color[3] = { ambient->color[0], ambient->color[1], ambient->color[2] };
+    for (int i = 0; i < gfx.num_lights; i++) {
+        float intensity = dot3(normal, gfx.lights[i].model_direction);
+        if (intensity > 0.0f) {
+            color[0] += gfx.lights[i].color[0] * intensity;
+            color[1] += gfx.lights[i].color[1] * intensity;
+            color[2] += gfx.lights[i].color[2] * intensity;
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        vertex->color[i] = clamp_float(color[i], 0.0f, 255.0f);
+    }
+}
+
+// Environment mapping: texture coordinates from the normal, facing the camera. These come out in 0-0x8000, before the
+// texture scale.
+static void texgen_vertex(gfx_vertex_t* vertex, const float* normal) {
+    for (int i = 0; i < 2; i++) {
+        float d = clamp_float(dot3(normal, gfx.model_lookat[i]), -1.0f, 1.0f);
+        if (gfx.geometry_mode & gfx.geometry_bits->texture_gen_linear) {
+            vertex->texcoord[i] = acosf(-d) / (float)M_PI * 0x8000;
+        } else {
+            vertex->texcoord[i] = (d + 1.0f) * 0x4000;
+        }
+    }
+}
+
+static byte clip_codes(const float* position) {
+    float x = position[0], y = position[1], z = position[2], w = position[3];
+    float guard = w * gfx.clip_ratio;
+    byte clip = 0;
+    if (z < -w) clip |= CLIP_NEAR;
+    if (z > w)  clip |= CLIP_FAR;
+    if (x < -guard) clip |= CLIP_X_NEG;
+    if (x > guard)  clip |= CLIP_X_POS;
+    if (y < -guard) clip |= CLIP_Y_NEG;
+    if (y > guard)  clip |= CLIP_Y_POS;
+    return clip;
+}
+
+static void gfx_vertices(word address, int index, int count) {
+    address = segmented_address(address);
+    update_matrices();
+
+    const gfx_geometry_bits_t* bits = gfx.geometry_bits;
+    bool lighting = gfx.geometry_mode & bits->lighting;
+    bool texgen = lighting && (gfx.geometry_mode & bits->texture_gen);
+    bool fog = gfx.geometry_mode & bits->fog;
+
+    for (int i = 0; i < count; i++, address += 16) {
+        gfx_vertex_t* vertex = &gfx.vertices[(index + i) & (GFX_MAX_VERTICES - 1)];
+        transform_point(vertex->position, &gfx.mvp,
+                        (shalf)rdram_half(address), (shalf)rdram_half(address + 2), (shalf)rdram_half(address + 4));
+
+        vertex->texcoord[0] = (shalf)rdram_half(address + 8);
+        vertex->texcoord[1] = (shalf)rdram_half(address + 10);
+        vertex->color[3] = RDRAM_BYTE(address + 15);
+
+        // With lighting on, the color is a normal instead
+        if (lighting) {
+            float normal[3] = {
+                    (sbyte)RDRAM_BYTE(address + 12),
+                    (sbyte)RDRAM_BYTE(address + 13),
+                    (sbyte)RDRAM_BYTE(address + 14)
+            };
+            normalize(normal);
+            light_vertex(vertex, normal);
+            if (texgen) {
+                texgen_vertex(vertex, normal);
+            }
+        } else {
+            for (int c = 0; c < 3; c++) {
+                vertex->color[c] = RDRAM_BYTE(address + 12 + c);
+            }
+        }
+
+        vertex->texcoord[0] *= gfx.texture.scale_s;
+        vertex->texcoord[1] *= gfx.texture.scale_t;
+
+        // Fog goes in shade alpha, for the blender to use
+        if (fog && vertex->position[3] != 0.0f) {
+            float depth = vertex->position[2] / vertex->position[3];
+            vertex->color[3] = clamp_float(depth * gfx.fog_multiplier + gfx.fog_offset, 0.0f, 255.0f);
+        }
+
+        vertex->clip = clip_codes(vertex->position);
+    }
+}
+
+// Screen space depth of a vertex, the way BRANCH_Z compares it: s15.16 in the 0-0x3FF depth range
+static sword vertex_depth(const gfx_vertex_t* vertex) {
+    float w = vertex->position[3] != 0.0f ? vertex->position[3] : 1.0f;
+    float z = gfx.viewport_translate[2] + gfx.viewport_scale[2] * vertex->position[2] / w;
+    return (sword)(z * 65536.0f);
+}
+
+static void gfx_modify_vertex(int index, int where, word value) {
+    gfx_vertex_t* vertex = &gfx.vertices[index & (GFX_MAX_VERTICES - 1)];
+    switch (where) {
+        case 0x10: // G_MWO_POINT_RGBA
+            vertex->color[0] = (value >> 24) & 0xFF;
+            vertex->color[1] = (value >> 16) & 0xFF;
+            vertex->color[2] = (value >> 8) & 0xFF;
+            vertex->color[3] = value & 0xFF;
+            break;
+        case 0x14: // G_MWO_POINT_ST
+            vertex->texcoord[0] = (shalf)(value >> 16) * gfx.texture.scale_s;
+            vertex->texcoord[1] = (shalf)value * gfx.texture.scale_t;
+            break;
+        case 0x18: // G_MWO_POINT_XYSCREEN
+            // Screen coordinates, s13.2. Turn them back into clip space so they come out there again.
+            if (gfx.viewport_scale[0] != 0.0f && gfx.viewport_scale[1] != 0.0f) {
+                float x = (shalf)(value >> 16) / 4.0f;
+                float y = (shalf)value / 4.0f;
+                vertex->position[0] = (x - gfx.viewport_translate[0]) / gfx.viewport_scale[0] * vertex->position[3];
+                vertex->position[1] = (gfx.viewport_translate[1] - y) / gfx.viewport_scale[1] * vertex->position[3];
+                vertex->clip = clip_codes(vertex->position);
+            }
+            break;
+        case 0x1C: // G_MWO_POINT_ZSCREEN
+            if (gfx.viewport_scale[2] != 0.0f) {
+                float z = (sword)value / 65536.0f;
+                vertex->position[2] = (z - gfx.viewport_translate[2]) / gfx.viewport_scale[2] * vertex->position[3];
+                vertex->clip = clip_codes(vertex->position);
+            }
+            break;
+        default:
+            logwarn("HLE graphics: modify vertex at unknown offset 0x%02X", where);
+            break;
+    }
+}
+
+// Ends the current display list if every vertex in the range is outside the same plane
+static void gfx_cull_dl(int first, int last) {
+    if (first > last) {
+        return;
+    }
+    byte clip = 0xFF;
+    for (int i = first; i <= last; i++) {
+        clip &= gfx.vertices[i & (GFX_MAX_VERTICES - 1)].clip;
+    }
+    if (clip != 0) {
+        if (gfx.dl_depth == 0) {
+            gfx.running = false;
+        } else {
+            gfx.pc = gfx.dl_stack[--gfx.dl_depth];
+        }
+    }
+}
+
+// ----- Triangles -----
+
+INLINE sword float_to_s16_16(float value) {
+    return (sword)(clamp_float(value, -32768.0f, 32767.99f) * 65536.0f);
+}
+
+// The RDP wants each coefficient split into 16 bit integer and fractional halves, packed two values to a word.
+INLINE word pack_integers(sword a, sword b) {
+    return (a & 0xFFFF0000) | ((b >> 16) & 0xFFFF);
+}
+
+INLINE word pack_fractions(sword a, sword b) {
+    return (a << 16) | (b & 0xFFFF);
+}
+
+typedef struct triangle_edges {
+    float hx, hy;
+    float mx, my;
+    float attribute_factor;
+    float ish;
+    float fy;
+} triangle_edges_t;
+
+// Gradients of one attribute across the triangle, given its values at the sorted vertices
+typedef struct attribute_gradients {
+    float start; // at the first scanline
+    float dx;
+    float de;    // along the major edge
+    float dy;
+} attribute_gradients_t;
+
+INLINE attribute_gradients_t attribute_gradients(const triangle_edges_t* edges, float a1, float a2, float a3) {
+    float ma = a2 - a1;
+    float ha = a3 - a1;
+    attribute_gradients_t g;
+    g.dx = (edges->hy * ma - edges->my * ha) * edges->attribute_factor;
+    g.dy = (edges->mx * ha - edges->hx * ma) * edges->attribute_factor;
+    g.de = g.dy + g.dx * edges->ish;
+    g.start = a1 + edges->fy * g.de;
+    return g;
+}
+
+static void emit_coefficients(word* out, const attribute_gradients_t* g, int count) {
+    // Four values per group of 8 words: integers of start and d/dx, fractions of start and d/dx, then the same for
+    // d/de and d/dy. Shade uses all four, texture uses three (S, T, W) and leaves the last one empty.
+    sword start[4] = {0}, dx[4] = {0}, de[4] = {0}, dy[4] = {0};
+    for (int i = 0; i < count; i++) {
+        start[i] = float_to_s16_16(g[i].start);
+        dx[i] = float_to_s16_16(g[i].dx);
+        de[i] = float_to_s16_16(g[i].de);
+        dy[i] = float_to_s16_16(g[i].dy);
+    }
+    out[0]  = pack_integers(start[0], start[1]);
+    out[1]  = pack_integers(start[2], start[3]);
+    out[2]  = pack_integers(dx[0], dx[1]);
+    out[3]  = pack_integers(dx[2], dx[3]);
+    out[4]  = pack_fractions(start[0], start[1]);
+    out[5]  = pack_fractions(start[2], start[3]);
+    out[6]  = pack_fractions(dx[0], dx[1]);
+    out[7]  = pack_fractions(dx[2], dx[3]);
+    out[8]  = pack_integers(de[0], de[1]);
+    out[9]  = pack_integers(de[2], de[3]);
+    out[10] = pack_integers(dy[0], dy[1]);
+    out[11] = pack_integers(dy[2], dy[3]);
+    out[12] = pack_fractions(de[0], de[1]);
+    out[13] = pack_fractions(de[2], de[3]);
+    out[14] = pack_fractions(dy[0], dy[1]);
+    out[15] = pack_fractions(dy[2], dy[3]);
+}
+
+// Builds the RDP's edge walker command for a screen space triangle
+static void setup_triangle(const gfx_screen_vertex_t* a, const gfx_screen_vertex_t* b, const gfx_screen_vertex_t* c) {
+    const gfx_geometry_bits_t* bits = gfx.geometry_bits;
+    bool shade = gfx.geometry_mode & bits->shade;
+    bool texture = gfx.texture.on;
+    bool zbuffer = gfx.geometry_mode & bits->zbuffer;
+
+    // Top to bottom
+    const gfx_screen_vertex_t* v1 = a;
+    const gfx_screen_vertex_t* v2 = b;
+    const gfx_screen_vertex_t* v3 = c;
+    const gfx_screen_vertex_t* temp;
+    if (v2->y < v1->y) { temp = v1; v1 = v2; v2 = temp; }
+    if (v3->y < v2->y) { temp = v2; v2 = v3; v3 = temp; }
+    if (v2->y < v1->y) { temp = v1; v1 = v2; v2 = temp; }
+
+    // Y is s11.2
+    float y1 = floorf(v1->y * 4.0f) / 4.0f;
+    float y2 = floorf(v2->y * 4.0f) / 4.0f;
+    float y3 = floorf(v3->y * 4.0f) / 4.0f;
+
+    triangle_edges_t edges;
+    edges.hx = v3->x - v1->x;
+    edges.hy = y3 - y1;
+    edges.mx = v2->x - v1->x;
+    edges.my = y2 - y1;
+    float lx = v3->x - v2->x;
+    float ly = y3 - y2;
+
+    float nz = edges.hx * edges.my - edges.hy * edges.mx;
+    if (nz == 0.0f) {
+        return; // Nothing to draw
+    }
+    edges.attribute_factor = -1.0f / nz;
+    edges.ish = edges.hy != 0.0f ? edges.hx / edges.hy : 0.0f;
+    float ism = edges.my != 0.0f ? edges.mx / edges.my : 0.0f;
+    float isl = ly != 0.0f ? lx / ly : 0.0f;
+    edges.fy = floorf(y1) - y1;
+
+    word command[44];
+    int length = 8;
+    byte id = 0x08 | (shade ? 0x04 : 0) | (texture ? 0x02 : 0) | (zbuffer ? 0x01 : 0);
+    bool left_major = nz < 0;
+
+    command[0] = (id << 24) | (left_major << 23) | ((gfx.texture.level & 7) << 19) | ((gfx.texture.tile & 7) << 16)
+                 | ((sword)(y3 * 4.0f) & 0x3FFF);
+    command[1] = (((sword)(y2 * 4.0f) & 0x3FFF) << 16) | ((sword)(y1 * 4.0f) & 0x3FFF);
+    command[2] = float_to_s16_16(v2->x);
+    command[3] = float_to_s16_16(isl);
+    command[4] = float_to_s16_16(v1->x + edges.fy * edges.ish);
+    command[5] = float_to_s16_16(edges.ish);
+    command[6] = float_to_s16_16(v1->x + edges.fy * ism);
+    command[7] = float_to_s16_16(ism);
+
+    if (shade) {
+        attribute_gradients_t g[4];
+        for (int i = 0; i < 4; i++) {
+            g[i] = attribute_gradients(&edges, v1->color[i], v2->color[i], v3->color[i]);
+        }
+        emit_coefficients(&command[length], g, 4);
+        length += 16;
+    }
+
+    if (texture) {
+        // Perspective correction: the RDP divides S and T by W per pixel, so hand it S/W, T/W and 1/W, normalized so
+        // the largest 1/W is as large as it can be.
+        float w1 = 1.0f, w2 = 1.0f, w3 = 1.0f;
+        if (gfx.othermode_h & (1 << G_MDSFT_TEXTPERSP)) {
+            float max_w = fmaxf(v1->inv_w, fmaxf(v2->inv_w, v3->inv_w));
+            if (max_w > 0.0f) {
+                w1 = v1->inv_w / max_w;
+                w2 = v2->inv_w / max_w;
+                w3 = v3->inv_w / max_w;
+            }
+        }
+        attribute_gradients_t g[3];
+        g[0] = attribute_gradients(&edges, v1->texcoord[0] * w1, v2->texcoord[0] * w2, v3->texcoord[0] * w3);
+        g[1] = attribute_gradients(&edges, v1->texcoord[1] * w1, v2->texcoord[1] * w2, v3->texcoord[1] * w3);
+        g[2] = attribute_gradients(&edges, w1 * 0x7FFF, w2 * 0x7FFF, w3 * 0x7FFF);
+        emit_coefficients(&command[length], g, 3);
+        length += 16;
+    }
+
+    if (zbuffer) {
+        attribute_gradients_t g = attribute_gradients(&edges, v1->z, v2->z, v3->z);
+        command[length++] = float_to_s16_16(g.start);
+        command[length++] = float_to_s16_16(g.dx);
+        command[length++] = float_to_s16_16(g.de);
+        command[length++] = float_to_s16_16(g.dy);
+    }
+
+    rdp_run_hle_command(command);
+}
+
+INLINE void lerp_vertex(gfx_vertex_t* out, const gfx_vertex_t* a, const gfx_vertex_t* b, float t) {
+    for (int i = 0; i < 4; i++) {
+        out->position[i] = a->position[i] + (b->position[i] - a->position[i]) * t;
+        out->color[i] = a->color[i] + (b->color[i] - a->color[i]) * t;
+    }
+    for (int i = 0; i < 2; i++) {
+        out->texcoord[i] = a->texcoord[i] + (b->texcoord[i] - a->texcoord[i]) * t;
+    }
+}
+
+// Signed distance from a clip plane, inside when it's positive
+INLINE float plane_distance(const gfx_vertex_t* vertex, byte plane) {
+    const float* p = vertex->position;
+    float guard = p[3] * gfx.clip_ratio;
+    switch (plane) {
+        case CLIP_NEAR:  return p[2] + p[3];
+        case CLIP_X_NEG: return p[0] + guard;
+        case CLIP_X_POS: return guard - p[0];
+        case CLIP_Y_NEG: return p[1] + guard;
+        case CLIP_Y_POS: return guard - p[1];
+        default: logfatal("Unknown clip plane %d", plane);
+    }
+}
+
+// Sutherland-Hodgman, against each plane any of the vertices are outside of
+static int clip_polygon(gfx_vertex_t* polygon, int count, byte planes) {
+    gfx_vertex_t buffer[GFX_MAX_CLIPPED_VERTICES];
+    gfx_vertex_t* in = polygon;
+    gfx_vertex_t* out = buffer;
+
+    for (byte plane = CLIP_NEAR; plane <= CLIP_Y_POS; plane <<= 1) {
+        if (!(planes & plane & CLIP_PLANES)) {
+            continue;
+        }
+        int out_count = 0;
+        for (int i = 0; i < count && out_count < GFX_MAX_CLIPPED_VERTICES - 1; i++) {
+            const gfx_vertex_t* current = &in[i];
+            const gfx_vertex_t* next = &in[(i + 1) % count];
+            float d_current = plane_distance(current, plane);
+            float d_next = plane_distance(next, plane);
+            if (d_current >= 0) {
+                out[out_count++] = *current;
+            }
+            if ((d_current >= 0) != (d_next >= 0)) {
+                lerp_vertex(&out[out_count++], current, next, d_current / (d_current - d_next));
+            }
+        }
+        count = out_count;
+        if (count < 3) {
+            return 0;
+        }
+        gfx_vertex_t* swap = in;
+        in = out;
+        out = swap;
+    }
+
+    if (in != polygon) {
+        memcpy(polygon, in, count * sizeof(gfx_vertex_t));
+    }
+    return count;
+}
+
+static void project_vertex(gfx_screen_vertex_t* out, const gfx_vertex_t* vertex) {
+    float w = vertex->position[3];
+    float inv_w = w != 0.0f ? 1.0f / w : 1.0f;
+    out->x = gfx.viewport_translate[0] + gfx.viewport_scale[0] * vertex->position[0] * inv_w;
+    out->y = gfx.viewport_translate[1] - gfx.viewport_scale[1] * vertex->position[1] * inv_w;
+    float z = gfx.viewport_translate[2] + gfx.viewport_scale[2] * vertex->position[2] * inv_w;
+    out->z = clamp_float(z * 32.0f, 0.0f, 0x7FFF);
+    out->inv_w = inv_w;
+    memcpy(out->color, vertex->color, sizeof(out->color));
+    memcpy(out->texcoord, vertex->texcoord, sizeof(out->texcoord));
+}
+
+static void gfx_triangle(int i1, int i2, int i3) {
+    const gfx_vertex_t* v1 = &gfx.vertices[i1 & (GFX_MAX_VERTICES - 1)];
+    const gfx_vertex_t* v2 = &gfx.vertices[i2 & (GFX_MAX_VERTICES - 1)];
+    const gfx_vertex_t* v3 = &gfx.vertices[i3 & (GFX_MAX_VERTICES - 1)];
+
+    // Entirely outside one of the planes
+    if (v1->clip & v2->clip & v3->clip) {
+        return;
+    }
+
+    gfx_vertex_t polygon[GFX_MAX_CLIPPED_VERTICES];
+    polygon[0] = *v1;
+    polygon[1] = *v2;
+    polygon[2] = *v3;
+    int count = 3;
+
+    // Flat shading takes the color of the first vertex
+    if (!(gfx.geometry_mode & gfx.geometry_bits->shading_smooth)) {
+        memcpy(polygon[1].color, v1->color, sizeof(v1->color));
+        memcpy(polygon[2].color, v1->color, sizeof(v1->color));
+    }
+
+    byte planes = (v1->clip | v2->clip | v3->clip) & CLIP_PLANES;
+    if (planes) {
+        count = clip_polygon(polygon, count, planes);
+    }
+    if (count < 3) {
+        return;
+    }
+
+    gfx_screen_vertex_t screen[GFX_MAX_CLIPPED_VERTICES];
+    for (int i = 0; i < count; i++) {
+        project_vertex(&screen[i], &polygon[i]);
+    }
+
+    // Counter clockwise is the front, and Y points down on the screen.
+    float area = 0.0f;
+    for (int i = 0; i < count; i++) {
+        const gfx_screen_vertex_t* p = &screen[i];
+        const gfx_screen_vertex_t* q = &screen[(i + 1) % count];
+        area += p->x * q->y - q->x * p->y;
+    }
+    bool front = area < 0.0f;
+    if ((front && (gfx.geometry_mode & gfx.geometry_bits->cull_front))
+        || (!front && (gfx.geometry_mode & gfx.geometry_bits->cull_back))) {
+        return;
+    }
+
+    for (int i = 1; i + 1 < count; i++) {
+        setup_triangle(&screen[0], &screen[i], &screen[i + 1]);
+    }
+}
+
+// ----- RDP commands -----
+
+static void rdp_command(word w0, word w1) {
+    word command[2] = { w0, w1 };
+    switch (w0 >> 24) {
+        case 0xFD: // SET_TEXTURE_IMAGE
+        case 0xFE: // SET_Z_IMAGE
+        case 0xFF: // SET_COLOR_IMAGE
+            command[1] = segmented_address(w1);
+            break;
+        case 0xEF: // SET_OTHER_MODES
+            gfx.othermode_h = w0 & 0xFFFFFF;
+            gfx.othermode_l = w1;
+            break;
+    }
+    rdp_run_hle_command(command);
+}
+
+static void gfx_set_othermode(bool high, int shift, int length, word data) {
+    word mask = (word)((((dword)1 << length) - 1) << shift);
+    word* mode = high ? &gfx.othermode_h : &gfx.othermode_l;
+    *mode = (*mode & ~mask) | (data & mask);
+
+    word command[2] = { 0xEF000000 | (gfx.othermode_h & 0xFFFFFF), gfx.othermode_l };
+    rdp_run_hle_command(command);
+}
+
+// Texture rectangles take the two commands after them along, for the texture coordinates and their slopes.
+static void gfx_texture_rectangle(word w0, word w1) {
+    word command[4] = { w0, w1, RDRAM_WORD(gfx.pc + 4), RDRAM_WORD(gfx.pc + 12) };
+    gfx.pc += 16;
+    rdp_run_hle_command(command);
+}
+
+// ----- Display lists -----
+
+static void gfx_display_list(word address, bool push) {
+    if (push) {
+        if (gfx.dl_depth >= GFX_DL_STACK_SIZE) {
+            logwarn("HLE graphics: display list stack overflow");
+            return;
+        }
+        gfx.dl_stack[gfx.dl_depth++] = gfx.pc;
+    }
+    gfx.pc = segmented_address(address);
+}
+
+static void gfx_end_display_list() {
+    if (gfx.dl_depth == 0) {
+        gfx.running = false;
+    } else {
+        gfx.pc = gfx.dl_stack[--gfx.dl_depth];
+    }
+}
+
+static void gfx_branch_z(int vertex, word z) {
+    if (vertex_depth(&gfx.vertices[vertex & (GFX_MAX_VERTICES - 1)]) <= (sword)z) {
+        gfx_display_list(gfx.rdphalf_1, false);
+    }
+}
+
+// The other microcode can't be followed, so the rest of the display list is skipped, and tasks using this microcode run
+// on the RSP from then on.
+static void gfx_load_ucode() {
+    logwarn("HLE graphics: display list loads another microcode, running its microcode on the RSP from now on");
+    gfx.loaded_ucode = true;
+    gfx.running = false;
+}
+
+static void gfx_texture(word w0, word w1, bool on) {
+    gfx.texture.on = on;
+    gfx.texture.tile = (w0 >> 8) & 7;
+    gfx.texture.level = (w0 >> 11) & 7;
+    gfx.texture.scale_s = (w1 >> 16) / 65536.0f;
+    gfx.texture.scale_t = (w1 & 0xFFFF) / 65536.0f;
+}
+
+static void gfx_fog(word w1) {
+    gfx.fog_multiplier = (shalf)(w1 >> 16);
+    gfx.fog_offset = (shalf)w1;
+}
+
+// F3D and F3DEX 1.x
+static void f3d_command(word w0, word w1) {
+    byte command = w0 >> 24;
+    bool f3dex = gfx.ucode == GFX_UCODE_F3DEX;
+    switch (command) {
+        case 0x00: // G_SPNOOP
+            break;
+        case 0x01: { // G_MTX
+            byte params = (w0 >> 16) & 0xFF;
+            gfx_matrix(w1, params & 0x01, params & 0x02, params & 0x04);
+            break;
+        }
+        case 0x03: { // G_MOVEMEM
+            byte index = (w0 >> 16) & 0xFF;
+            if (index == 0x80) {
+                gfx_viewport(w1);
+            } else if (index == 0x82) {
+                gfx_lookat(1, w1);
+            } else if (index == 0x84) {
+                gfx_lookat(0, w1);
+            } else if (index >= 0x86 && index <= 0x94) {
+                gfx_light((index - 0x86) >> 1, w1);
+            } else if (index == 0x9E) {
+                // The forced matrix comes in four parts, all next to each other in RDRAM.
+                gfx_force_matrix(w1);
+            } else if (index > 0x9E && index <= 0xA4) {
+                break;
+            } else {
+                warn_unsupported(command, "G_MOVEMEM to an unknown index");
+            }
+            break;
+        }
+        case 0x04: // G_VTX
+            if (f3dex) {
+                gfx_vertices(w1, ((w0 >> 16) & 0xFF) >> 1, (w0 >> 10) & 0x3F);
+            } else {
+                gfx_vertices(w1, (w0 >> 16) & 0xF, ((w0 >> 20) & 0xF) + 1);
+            }
+            break;
+        case 0x06: // G_DL
+            gfx_display_list(w1, ((w0 >> 16) & 0xFF) == 0);
+            break;
+        case 0xAF: // G_LOAD_UCODE
+            gfx_load_ucode();
+            break;
+        case 0xB0: // G_BRANCH_Z
+            if (f3dex) {
+                gfx_branch_z((w0 & 0xFFF) >> 1, w1);
+            } else {
+                warn_unsupported(command, "G_BRANCH_Z");
+            }
+            break;
+        case 0xB1: // G_TRI2
+            if (f3dex) {
+                gfx_triangle(((w0 >> 16) & 0xFF) >> 1, ((w0 >> 8) & 0xFF) >> 1, (w0 & 0xFF) >> 1);
+                gfx_triangle(((w1 >> 16) & 0xFF) >> 1, ((w1 >> 8) & 0xFF) >> 1, (w1 & 0xFF) >> 1);
+            } else {
+                warn_unsupported(command, "G_TRI4");
+            }
+            break;
+        case 0xB2: // G_MODIFYVTX on F3DEX, G_RDPHALF_CONT on F3D
+            if (f3dex) {
+                gfx_modify_vertex((w0 & 0xFFFF) >> 1, (w0 >> 16) & 0xFF, w1);
+            }
+            break;
+        case 0xB3: // G_RDPHALF_2
+            break;
+        case 0xB4: // G_RDPHALF_1
+            gfx.rdphalf_1 = w1;
+            break;
+        case 0xB5: // G_QUAD on F3DEX, G_LINE3D on F3D
+            if (f3dex) {
+                int v0 = ((w1 >> 24) & 0xFF) >> 1;
+                int v1 = ((w1 >> 16) & 0xFF) >> 1;
+                int v2 = ((w1 >> 8) & 0xFF) >> 1;
+                int v3 = (w1 & 0xFF) >> 1;
+                gfx_triangle(v0, v1, v2);
+                gfx_triangle(v0, v2, v3);
+            } else {
+                warn_unsupported(command, "G_LINE3D");
+            }
+            break;
+        case 0xB6: // G_CLEARGEOMETRYMODE
+            gfx.geometry_mode &= ~w1;
+            break;
+        case 0xB7: // G_SETGEOMETRYMODE
+            gfx.geometry_mode |= w1;
+            break;
+        case 0xB8: // G_ENDDL
+            gfx_end_display_list();
+            break;
+        case 0xB9: // G_SETOTHERMODE_L
+            gfx_set_othermode(false, (w0 >> 8) & 0xFF, w0 & 0xFF, w1);
+            break;
+        case 0xBA: // G_SETOTHERMODE_H
+            gfx_set_othermode(true, (w0 >> 8) & 0xFF, w0 & 0xFF, w1);
+            break;
+        case 0xBB: // G_TEXTURE
+            gfx_texture(w0, w1, w0 & 0xFF);
+            break;
+        case 0xBC: { // G_MOVEWORD
+            byte index = w0 & 0xFF;
+            half offset = (w0 >> 8) & 0xFFFF;
+            switch (index) {
+                case 0x00: // G_MW_MATRIX
+                    warn_unsupported(command, "G_MW_MATRIX");
+                    break;
+                case 0x02: // G_MW_NUMLIGHT
+                    gfx_num_lights((int)((w1 - 0x80000000) >> 5) - 1);
+                    break;
+                case 0x04: // G_MW_CLIP
+                    if (offset == 0x04 && (w1 & 0xFFFF) != 0) {
+                        gfx.clip_ratio = w1 & 0xFFFF;
+                    }
+                    break;
+                case 0x06: // G_MW_SEGMENT
+                    gfx.segments[(offset >> 2) & 0xF] = w1 & 0xFFFFFF;
+                    break;
+                case 0x08: // G_MW_FOG
+                    gfx_fog(w1);
+                    break;
+                case 0x0A: // G_MW_LIGHTCOL
+                    if ((offset & 7) == 0) {
+                        gfx_light_color(offset >> 5, w1);
+                    }
+                    break;
+                case 0x0C: // G_MW_POINTS
+                    gfx_modify_vertex(offset / 40, offset % 40, w1);
+                    break;
+                case 0x0E: // G_MW_PERSPNORM
+                    break;
+                default:
+                    warn_unsupported(command, "G_MOVEWORD to an unknown index");
+                    break;
+            }
+            break;
+        }
+        case 0xBD: // G_POPMTX
+            if (w1 == 0) {
+                gfx_pop_matrix(1);
+            }
+            break;
+        case 0xBE: // G_CULLDL
+            if (f3dex) {
+                gfx_cull_dl((w0 & 0xFFFF) >> 1, (w1 & 0xFFFF) >> 1);
+            } else {
+                gfx_cull_dl((w0 & 0xFFFF) / 40, (w1 & 0xFFFF) / 40 - 1);
+            }
+            break;
+        case 0xBF: // G_TRI1
+            if (f3dex) {
+                gfx_triangle(((w1 >> 16) & 0xFF) >> 1, ((w1 >> 8) & 0xFF) >> 1, (w1 & 0xFF) >> 1);
+            } else {
+                gfx_triangle(((w1 >> 16) & 0xFF) / 10, ((w1 >> 8) & 0xFF) / 10, (w1 & 0xFF) / 10);
+            }
+            break;
+        case 0xC0: // G_NOOP
+            break;
+        case 0xE4: // G_TEXRECT
+        case 0xE5: // G_TEXRECTFLIP
+            gfx_texture_rectangle(w0, w1);
+            break;
+        default:
+            if (command >= 0xE6) {
+                rdp_command(w0, w1);
+            } else {
+                warn_unsupported(command, "Unknown command");
+            }
+            break;
+    }
+}
+
+static void f3dex2_command(word w0, word w1) {
+    byte command = w0 >> 24;
+    switch (command) {
+        case 0x00: // G_NOOP
+            break;
+        case 0x01: { // G_VTX
+            int count = (w0 >> 12) & 0xFF;
+            gfx_vertices(w1, ((w0 >> 1) & 0x7F) - count, count);
+            break;
+        }
+        case 0x02: // G_MODIFYVTX
+            gfx_modify_vertex((w0 & 0xFFFF) >> 1, (w0 >> 16) & 0xFF, w1);
+            break;
+        case 0x03: // G_CULLDL
+            gfx_cull_dl((w0 & 0xFFFF) >> 1, (w1 & 0xFFFF) >> 1);
+            break;
+        case 0x04: // G_BRANCH_Z
+            gfx_branch_z((w0 & 0xFFF) >> 1, w1);
+            break;
+        case 0x05: // G_TRI1
+            gfx_triangle(((w0 >> 16) & 0xFF) >> 1, ((w0 >> 8) & 0xFF) >> 1, (w0 & 0xFF) >> 1);
+            break;
+        case 0x06: // G_TRI2
+        case 0x07: // G_QUAD
+            gfx_triangle(((w0 >> 16) & 0xFF) >> 1, ((w0 >> 8) & 0xFF) >> 1, (w0 & 0xFF) >> 1);
+            gfx_triangle(((w1 >> 16) & 0xFF) >> 1, ((w1 >> 8) & 0xFF) >> 1, (w1 & 0xFF) >> 1);
+            break;
+        case 0x08: // G_LINE3D
+            warn_unsupported(command, "G_LINE3D");
+            break;
+        case 0xD3: // G_SPECIAL_3
+        case 0xD4: // G_SPECIAL_2
+        case 0xD5: // G_SPECIAL_1
+            break;
+        case 0xD6: // G_DMA_IO
+            warn_unsupported(command, "G_DMA_IO");
+            break;
+        case 0xD7: // G_TEXTURE
+            gfx_texture(w0, w1, (w0 >> 1) & 0x7F);
+            break;
+        case 0xD8: // G_POPMTX
+            gfx_pop_matrix(w1 >> 6);
+            break;
+        case 0xD9: // G_GEOMETRYMODE
+            gfx.geometry_mode = (gfx.geometry_mode & w0 & 0xFFFFFF) | w1;
+            break;
+        case 0xDA: { // G_MTX
+            // G_MTX_PUSH is inverted in the command
+            byte params = (w0 & 0xFF) ^ 0x01;
+            gfx_matrix(w1, params & 0x04, params & 0x02, params & 0x01);
+            break;
+        }
+        case 0xDB: { // G_MOVEWORD
+            byte index = (w0 >> 16) & 0xFF;
+            half offset = w0 & 0xFFFF;
+            switch (index) {
+                case 0x00: // G_MW_MATRIX
+                    warn_unsupported(command, "G_MW_MATRIX");
+                    break;
+                case 0x02: // G_MW_NUMLIGHT
+                    gfx_num_lights(w1 / 24);
+                    break;
+                case 0x04: // G_MW_CLIP
+                    if (offset == 0x04 && (w1 & 0xFFFF) != 0) {
+                        gfx.clip_ratio = w1 & 0xFFFF;
+                    }
+                    break;
+                case 0x06: // G_MW_SEGMENT
+                    gfx.segments[(offset >> 2) & 0xF] = w1 & 0xFFFFFF;
+                    break;
+                case 0x08: // G_MW_FOG
+                    gfx_fog(w1);
+                    break;
+                case 0x0A: // G_MW_LIGHTCOL
+                    if ((offset % 24) == 0) {
+                        gfx_light_color(offset / 24 - 1, w1);
+                    }
+                    break;
+                case 0x0C: // G_MW_FORCEMTX
+                case 0x0E: // G_MW_PERSPNORM
+                    break;
+                default:
+                    warn_unsupported(command, "G_MOVEWORD to an unknown index");
+                    break;
+            }
+            break;
+        }
+        case 0xDC: { // G_MOVEMEM
+            byte index = w0 & 0xFF;
+            word offset = ((w0 >> 8) & 0xFF) << 3;
+            switch (index) {
+                case 0x08: // G_MV_VIEWPORT
+                    gfx_viewport(w1);
+                    break;
+                case 0x0A: // G_MV_LIGHT
+                    if (offset < 48) {
+                        gfx_lookat(offset / 24, w1);
+                    } else {
+                        gfx_light(offset / 24 - 2, w1);
+                    }
+                    break;
+                case 0x0E: // G_MV_MATRIX
+                    gfx_force_matrix(w1);
+                    break;
+                default:
+                    warn_unsupported(command, "G_MOVEMEM to an unknown index");
+                    break;
+            }
+            break;
+        }
+        case 0xDD: // G_LOAD_UCODE
+            gfx_load_ucode();
+            break;
+        case 0xDE: // G_DL
+            gfx_display_list(w1, ((w0 >> 16) & 0xFF) == 0);
+            break;
+        case 0xDF: // G_ENDDL
+            gfx_end_display_list();
+            break;
+        case 0xE0: // G_SPNOOP
+            break;
+        case 0xE1: // G_RDPHALF_1
+            gfx.rdphalf_1 = w1;
+            break;
+        case 0xE2: // G_SETOTHERMODE_L
+        case 0xE3: { // G_SETOTHERMODE_H
+            int length = (w0 & 0xFF) + 1;
+            int shift = 32 - ((w0 >> 8) & 0xFF) - length;
+            gfx_set_othermode(command == 0xE3, shift, length, w1);
+            break;
+        }
+        case 0xE4: // G_TEXRECT
+        case 0xE5: // G_TEXRECTFLIP
+            gfx_texture_rectangle(w0, w1);
+            break;
+        case 0xF1: // G_RDPHALF_2
+            break;
+        case 0xC0: // G_NOOP
+            break;
+        default:
+            if (command >= 0xE6) {
+                rdp_command(w0, w1);
+            } else {
+                warn_unsupported(command, "Unknown command");
+            }
+            break;
+    }
+}
+
+// ----- Microcode identification -----
+
+// The microcodes carry a version string in their data segment, e.g.
+// "RSP Gfx ucode F3DEX       fifo 2.05  Yoshitaka Yasumoto 1998 Nintendo." or "RSP SW Version: 2.0D, 04-01-96"
+static bool ucode_data_matches(word address, word length, const char* text, word* found) {
+    size_t text_length = strlen(text);
+    for (word offset = 0; offset + text_length <= length; offset++) {
+        bool match = true;
+        for (size_t i = 0; i < text_length && match; i++) {
+            match = RDRAM_BYTE(address + offset + i) == (byte)text[i];
+        }
+        if (match) {
+            *found = address + offset;
+            return true;
+        }
+    }
+    return false;
+}
+
+static gfx_ucode_t identify_ucode(word data, word data_size) {
+    word length = data_size != 0 && data_size < 0x800 ? data_size : 0x800;
+    word found;
+
+    if (ucode_data_matches(data, length, "RSP SW Version: 2.0", &found)) {
+        return GFX_UCODE_F3D;
+    }
+    if (ucode_data_matches(data, length, "RSP Gfx ucode ", &found)) {
+        found += 14;
+        // Only the triangle microcodes, not L3DEX (lines) or S2DEX (sprites)
+        if (RDRAM_BYTE(found) != 'F' || RDRAM_BYTE(found + 1) != '3' || RDRAM_BYTE(found + 2) != 'D') {
+            return GFX_UCODE_UNKNOWN;
+        }
+        // The major version is the first digit after the name
+        for (word i = 3; i < 48; i++) {
+            byte c = RDRAM_BYTE(found + i);
+            if (c >= '0' && c <= '9') {
+                return c >= '2' ? GFX_UCODE_F3DEX2 : GFX_UCODE_F3DEX;
+            }
+        }
+    }
+    return GFX_UCODE_UNKNOWN;
+}
+
+static void reset_state() {
+    memset(gfx.segments, 0, sizeof(gfx.segments));
+    gfx.dl_depth = 0;
+    gfx.modelview_depth = 0;
+    matrix_identity(&gfx.modelview[0]);
+    matrix_identity(&gfx.projection);
+    gfx.num_lights = 0;
+    memset(gfx.lights, 0, sizeof(gfx.lights));
+    memset(gfx.lookat, 0, sizeof(gfx.lookat));
+    gfx.clip_ratio = 2.0f;
+    gfx.geometry_mode = 0;
+    gfx.othermode_h = 0x080CFF;
+    gfx.othermode_l = 0;
+    gfx.texture.on = false;
+    gfx.mvp_dirty = true;
+    gfx.lights_dirty = true;
+}
+
+// Microcodes that were identified, but whose display lists turned out to load other microcodes.
+#define GFX_MAX_UNSUPPORTED_UCODES 8
+static word unsupported_ucode_data[GFX_MAX_UNSUPPORTED_UCODES];
+static int num_unsupported_ucodes = 0;
+
+static bool is_unsupported_ucode(word ucode_data) {
+    for (int i = 0; i < num_unsupported_ucodes; i++) {
+        if (unsupported_ucode_data[i] == ucode_data) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void mark_ucode_unsupported(word ucode_data) {
+    if (num_unsupported_ucodes < GFX_MAX_UNSUPPORTED_UCODES) {
+        unsupported_ucode_data[num_unsupported_ucodes++] = ucode_data;
+    } else {
+        unsupported_ucode_data[GFX_MAX_UNSUPPORTED_UCODES - 1] = ucode_data;
+    }
+}
+
+bool rsp_hle_gfx_task(const rsp_hle_task_t* task) {
+    static word last_ucode_data = 0xFFFFFFFF;
+    static gfx_ucode_t last_ucode = GFX_UCODE_UNKNOWN;
+
+    word ucode_data = task->ucode_data & 0xFFFFFF;
+    if (is_unsupported_ucode(ucode_data)) {
+        return false;
+    }
+    if (ucode_data != last_ucode_data) {
+        last_ucode = identify_ucode(ucode_data, task->ucode_data_size);
+        last_ucode_data = ucode_data;
+        if (last_ucode == GFX_UCODE_UNKNOWN) {
+            logwarn("HLE graphics: unsupported graphics microcode (data at 0x%08X), running it on the RSP instead", task->ucode_data);
+        }
+    }
+    if (last_ucode == GFX_UCODE_UNKNOWN) {
+        return false;
+    }
+
+    gfx.ucode = last_ucode;
+    gfx.geometry_bits = gfx.ucode == GFX_UCODE_F3DEX2 ? &f3dex2_geometry_bits : &f3d_geometry_bits;
+    reset_state();
+
+    gfx.pc = task->data_ptr & 0xFFFFF8;
+    gfx.running = true;
+    gfx.loaded_ucode = false;
+    for (int i = 0; gfx.running && i < GFX_MAX_COMMANDS; i++) {
+        word w0 = RDRAM_WORD(gfx.pc);
+        word w1 = RDRAM_WORD(gfx.pc + 4);
+        gfx.pc = (gfx.pc + 8) & 0xFFFFF8;
+        if (gfx.ucode == GFX_UCODE_F3DEX2) {
+            f3dex2_command(w0, w1);
+        } else {
+            f3d_command(w0, w1);
+        }
+    }
+    if (gfx.running) {
+        logwarn("HLE graphics: display list at 0x%08X didn't end", task->data_ptr);
+    }
+    if (gfx.loaded_ucode) {
+        mark_ucode_unsupported(ucode_data);
+    }
+    return true;
+}
@@ -0,0 +1,10 @@
+#ifndef N64_RSP_HLE_GFX_H
+#define N64_RSP_HLE_GFX_H
+
+#include "rsp_hle.h"
+
+// Runs a graphics task's display list, if it's for a microcode that's supported, sending the RDP commands it produces
+// straight to the RDP. Returns false if the microcode isn't supported.
+bool rsp_hle_gfx_task(const rsp_hle_task_t* task);
+
+#endif //N64_RSP_HLE_GFX_H
@@ -1,5 +1,6 @@
 #include "rsp_interface.h"
 #include "rsp.h"
+#include "rsp_hle.h"
 
 typedef union sp_status_write {
     word raw;
@@ -47,6 +48,7 @@ void rsp_status_reg_write(word value) {
     sp_status_write_t write;
     write.raw = value;
 
+    bool was_halted = N64RSP.status.halt;
     CLEAR_SET(N64RSP.status.halt,          write.clear_halt,          write.set_halt);
     if (N64RSP.status.halt) {
         N64RSP.steps = 0;
@@ -69,6 +71,11 @@ void rsp_status_reg_write(word value) {
     CLEAR_SET(N64RSP.status.signal_5,      write.clear_signal_5,      write.set_signal_5);
     CLEAR_SET(N64RSP.status.signal_6,      write.clear_signal_6,      write.set_signal_6);
     CLEAR_SET(N64RSP.status.signal_7,      write.clear_signal_7,      write.set_signal_7);
+
+    // The OS starts a task by unhalting the RSP, after setting up the signals above.
+    if (was_halted && !N64RSP.status.halt) {
+        rsp_hle_run_task();
+    }
 }
 
 word read_word_spreg(word address) {
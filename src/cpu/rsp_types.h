@@ -179,7 +179,7 @@ typedef struct rsp {
 
     bool semaphore_held;
 
-    byte sp_dmem[SP_DMEM_SIZE];
+    byte sp_dmem[SP_DMEM_SIZE] __attribute__((aligned(4096))); // page aligned for fastmem
     byte sp_imem[SP_IMEM_SIZE];
 } rsp_t;
 
@@ -29,6 +29,7 @@ INLINE void tlbwi(int index) {
 
     N64CP0.tlb[index].initialized = true;
 
+    cp0_translation_changed();
 }
 
 // Loads the contents of the pfn Hi, pfn Lo0, pfn Lo1, and page mask
@@ -60,7 +61,9 @@ MIPS_INSTR(mips_tlbr) {
 
     tlb_entry_t entry = N64CP0.tlb[index];
 
+    dword old_entry_hi = N64CP0.entry_hi.raw;
     N64CP0.entry_hi.raw  = entry.entry_hi.raw;
+    cp0_entry_hi_updated(old_entry_hi);
     N64CP0.entry_lo0.raw = entry.entry_lo0.raw & CP0_ENTRY_LO_WRITE_MASK;
     N64CP0.entry_lo1.raw = entry.entry_lo1.raw & CP0_ENTRY_LO_WRITE_MASK;
 
@@ -5,6 +5,9 @@
 #include <cflags.h>
 #include <log.h>
 #include <system/n64system.h>
+#include <cpu/dynarec/fastmem.h>
+#include <cpu/dynarec/dynarec_cache.h>
+#include <cpu/dynarec/dynarec_worker.h>
 #include <mem/pif.h>
 #include <rdp/rdp.h>
 #include <rdp/parallel_rdp_wrapper.h>
@@ -62,6 +65,21 @@ int main(int argc, char** argv) {
     bool interpreter = false;
     cflags_add_bool(flags, 'i', "interpreter", &interpreter, "Force the use of the interpreter");
 
+    bool fastmem = false;
+    cflags_add_bool(flags, 'f', "fastmem", &fastmem, "Map guest memory into one host region for faster recompiled memory accesses (Linux x86_64 only)");
+
+    bool jit_cache = false;
+    cflags_add_bool(flags, 'c', "jit-cache", &jit_cache, "Save compiled code next to the ROM and reuse it next time it's loaded");
+
+    bool background_jit = false;
+    cflags_add_bool(flags, 'b', "background-jit", &background_jit, "Compile code on a separate thread, interpreting it until it's ready");
+
+    bool hle_audio = false;
+    cflags_add_bool(flags, 'a', "hle-audio", &hle_audio, "Run audio microcode tasks in C instead of on the RSP (standard audio microcode only)");
+
+    bool hle_gfx = false;
+    cflags_add_bool(flags, 'g', "hle-gfx", &hle_gfx, "Run graphics microcode tasks in C instead of on the RSP (Fast3D, F3DEX and F3DEX2 only)");
+
     bool software_mode = false;
     cflags_add_bool(flags, 's', "software-mode", &software_mode, "Use software mode RDP (UNFINISHED!)");
 
@@ -126,6 +144,17 @@ int main(int argc, char** argv) {
         load_imgui_ui();
         register_imgui_event_handler(imgui_handle_event);
     }
+    n64sys.hle_audio = hle_audio;
+    n64sys.hle_gfx = hle_gfx;
+    if (fastmem && !interpreter) {
+        fastmem_init();
+    }
+    if (jit_cache && !interpreter) {
+        dynarec_cache_enable();
+    }
+    if (background_jit && !interpreter) {
+        dynarec_worker_start();
+    }
     if (tas_movie_path != NULL) {
         load_tas_movie(tas_movie_path);
     }
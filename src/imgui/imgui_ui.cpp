@@ -55,6 +55,8 @@ RingBuffer<double> frame_times;
 RingBuffer<ImU64> block_complilations;
 RingBuffer<ImU64> rsp_steps;
 RingBuffer<ImU64> codecache_bytes_used;
+RingBuffer<ImU64> codecache_evictions;
+RingBuffer<ImU64> dynarec_metadata_bytes;
 RingBuffer<ImU64> audiostream_bytes_available;
 RingBuffer<ImU64> si_interrupts;
 RingBuffer<ImU64> pi_interrupts;
@@ -149,7 +151,9 @@ void render_metrics_window() {
     rsp_steps.add_point(get_metric(METRIC_RSP_STEPS));
     double frametime = 1000.0f / ImGui::GetIO().Framerate;
     frame_times.add_point(frametime);
-    codecache_bytes_used.add_point(n64sys.dynarec->codecache_used);
+    codecache_bytes_used.add_point(get_metric(METRIC_CODECACHE_BYTES_USED));
+    codecache_evictions.add_point(get_metric(METRIC_CODECACHE_EVICTION));
+    dynarec_metadata_bytes.add_point(get_metric(METRIC_DYNAREC_METADATA_BYTES));
     audiostream_bytes_available.add_point(get_metric(METRIC_AUDIOSTREAM_AVAILABLE));
 
     si_interrupts.add_point(get_metric(METRIC_SI_INTERRUPT));
@@ -179,6 +183,8 @@ void render_metrics_window() {
     }
 
     ImGui::Text("Block compilations this frame: %ld", get_metric(METRIC_BLOCK_COMPILATION));
+    ImGui::Text("Blocks installed from the translation cache this frame: %ld", get_metric(METRIC_BLOCK_CACHE_INSTALL));
+    ImGui::Text("Hot blocks recompiled as traces this frame: %ld", get_metric(METRIC_TRACE_COMPILATION));
     ImPlot::SetNextPlotLimitsY(0, block_complilations.max(), ImGuiCond_Always, 0);
     ImPlot::SetNextPlotLimitsX(0, METRICS_HISTORY_ITEMS, ImGuiCond_Always);
     if (ImPlot::BeginPlot("Block Compilations Per Frame")) {
@@ -193,6 +199,29 @@ void render_metrics_window() {
         ImPlot::EndPlot();
     }
 
+    for (int i = 0; i < CODECACHE_REGIONS; i++) {
+        char label[32];
+        snprintf(label, sizeof(label), "Region %d%s", i, i == n64sys.dynarec->codecache_region ? " (current)" : "");
+        float fraction = (float)n64sys.dynarec->codecache_region_used[i] / n64sys.dynarec->codecache_region_size;
+        ImGui::ProgressBar(fraction, ImVec2(0, 0), label);
+    }
+
+    ImGui::Text("Codecache evictions this frame: %ld", get_metric(METRIC_CODECACHE_EVICTION));
+    ImPlot::SetNextPlotLimitsY(0, codecache_evictions.max(), ImGuiCond_Always, 0);
+    ImPlot::SetNextPlotLimitsX(0, METRICS_HISTORY_ITEMS, ImGuiCond_Always);
+    if (ImPlot::BeginPlot("Codecache Evictions Per Frame")) {
+        ImPlot::PlotBars("Codecache evictions", codecache_evictions.data, METRICS_HISTORY_ITEMS, 1, 0, codecache_evictions.offset);
+        ImPlot::EndPlot();
+    }
+
+    ImGui::Text("Dynarec metadata bytes: %ld", get_metric(METRIC_DYNAREC_METADATA_BYTES));
+    ImPlot::SetNextPlotLimitsY(0, dynarec_metadata_bytes.max(), ImGuiCond_Always, 0);
+    ImPlot::SetNextPlotLimitsX(0, METRICS_HISTORY_ITEMS, ImGuiCond_Always);
+    if (ImPlot::BeginPlot("Dynarec Metadata Bytes")) {
+        ImPlot::PlotLine("Dynarec metadata bytes", dynarec_metadata_bytes.data, METRICS_HISTORY_ITEMS, 1, 0, dynarec_metadata_bytes.offset);
+        ImPlot::EndPlot();
+    }
+
     ImGui::Text("Audio stream bytes available: %ld", get_metric(METRIC_AUDIOSTREAM_AVAILABLE));
     ImPlot::SetNextPlotLimitsY(0, audiostream_bytes_available.max(), ImGuiCond_Always, 0);
     ImPlot::SetNextPlotLimitsX(0, METRICS_HISTORY_ITEMS, ImGuiCond_Always);
@@ -1,21 +1,6 @@
 #include "vi.h"
 #include <rdp/rdp.h>
 
-#define ADDR_VI_STATUS_REG    0x04400000
-#define ADDR_VI_ORIGIN_REG    0x04400004
-#define ADDR_VI_WIDTH_REG     0x04400008
-#define ADDR_VI_V_INTR_REG    0x0440000C
-#define ADDR_VI_V_CURRENT_REG 0x04400010
-#define ADDR_VI_BURST_REG     0x04400014
-#define ADDR_VI_V_SYNC_REG    0x04400018
-#define ADDR_VI_H_SYNC_REG    0x0440001C
-#define ADDR_VI_LEAP_REG      0x04400020
-#define ADDR_VI_H_START_REG   0x04400024
-#define ADDR_VI_V_START_REG   0x04400028
-#define ADDR_VI_V_BURST_REG   0x0440002C
-#define ADDR_VI_X_SCALE_REG   0x04400030
-#define ADDR_VI_Y_SCALE_REG   0x04400034
-
 void write_word_vireg(word address, word value) {
     switch (address) {
         case ADDR_VI_STATUS_REG: {
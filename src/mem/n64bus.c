@@ -14,6 +14,22 @@
 #include "mem_util.h"
 #include "backup.h"
 
+// Status registers that games spin on while waiting for something to happen. They only change on a scheduler event, a
+// VI halfline, or when the RSP/RDP finish work, so reading one gives the same result until then.
+bool is_idle_poll_address(word physical_address) {
+    switch (physical_address) {
+        case ADDR_MI_INTR_REG:
+        case ADDR_VI_V_CURRENT_REG:
+        case ADDR_SP_STATUS_REG:
+        case ADDR_PI_STATUS_REG:
+        case ADDR_SI_STATUS_REG:
+        case ADDR_AI_STATUS_REG:
+            return true;
+        default:
+            return false;
+    }
+}
+
 dword get_vpn(dword address, word page_mask_raw) {
     dword tmp = page_mask_raw | 0x1FFF;
     // bits 40 and 41: bits 62 and 63 of the address, the "region"
@@ -63,7 +79,15 @@ tlb_entry_t* find_tlb_entry(dword vaddr, int* entry_number) {
     return NULL;
 }
 
-bool tlb_probe(dword vaddr, bus_access_t bus_access, word* paddr, int* entry_number) {
+soft_tlb_entry_t soft_tlb[SOFT_TLB_SIZE];
+
+void soft_tlb_flush() {
+    for (int i = 0; i < SOFT_TLB_SIZE; i++) {
+        soft_tlb[i].virtual_page = 1; // Never page aligned, so never matches
+    }
+}
+
+bool tlb_probe_slow(dword vaddr, bus_access_t bus_access, word* paddr, int* entry_number) {
     tlb_entry_t* entry = find_tlb_entry(vaddr, entry_number);
     if (!entry) {
         N64CP0.tlb_error = TLB_ERROR_MISS;
@@ -74,6 +98,7 @@ bool tlb_probe(dword vaddr, bus_access_t bus_access, word* paddr, int* entry_num
     word page_size = mask + 1;
     word odd = vaddr & page_size;
     word pfn;
+    bool dirty;
 
     if (!odd) {
         if (!(entry->entry_lo0.valid)) {
@@ -85,6 +110,7 @@ bool tlb_probe(dword vaddr, bus_access_t bus_access, word* paddr, int* entry_num
             return false;
         }
         pfn = entry->entry_lo0.pfn;
+        dirty = entry->entry_lo0.dirty;
     } else {
         if (!(entry->entry_lo1.valid)) {
             N64CP0.tlb_error = TLB_ERROR_INVALID;
@@ -95,12 +121,20 @@ bool tlb_probe(dword vaddr, bus_access_t bus_access, word* paddr, int* entry_num
             return false;
         }
         pfn = entry->entry_lo1.pfn;
+        dirty = entry->entry_lo1.dirty;
     }
 
+    word physical = (pfn << 12) | (vaddr & mask);
     if (paddr != NULL) {
-        *paddr = (pfn << 12) | (vaddr & mask);
+        *paddr = physical;
     }
 
+    soft_tlb_entry_t* cached = &soft_tlb[(vaddr / SOFT_TLB_PAGE_SIZE) & (SOFT_TLB_SIZE - 1)];
+    cached->virtual_page = vaddr & ~(dword)(SOFT_TLB_PAGE_SIZE - 1);
+    cached->physical_page = physical & ~(SOFT_TLB_PAGE_SIZE - 1);
+    cached->generation = N64CP0.translation_generation;
+    cached->writable = dirty;
+
     return true;
 }
 
@@ -287,7 +321,7 @@ void n64_write_physical_dword(word address, dword value) {
         logfatal("Tried to write to unaligned DWORD");
     }
     logdebug("Writing 0x%016lX to [0x%08X]", value, address);
-    invalidate_dynarec_page(address);
+    invalidate_dynarec_code(address);
     switch (address) {
         case REGION_RDRAM:
             dword_to_byte_array((byte*) &n64sys.mem.rdram, DWORD_ADDRESS(address) - SREGION_RDRAM, value);
@@ -433,7 +467,7 @@ void n64_write_physical_word(word address, word value) {
         logfatal("Tried to write to unaligned WORD");
     }
     logdebug("Writing 0x%08X to [0x%08X]", value, address);
-    invalidate_dynarec_page(WORD_ADDRESS(address));
+    invalidate_dynarec_code(WORD_ADDRESS(address));
     switch (address) {
         case REGION_RDRAM:
             word_to_byte_array((byte*) &n64sys.mem.rdram, WORD_ADDRESS(address) - SREGION_RDRAM, value);
@@ -624,7 +658,7 @@ void n64_write_physical_half(word address, half value) {
         logfatal("Tried to write to unaligned HALF");
     }
     logdebug("Writing 0x%04X to [0x%08X]", value, address);
-    invalidate_dynarec_page(HALF_ADDRESS(address));
+    invalidate_dynarec_code(HALF_ADDRESS(address));
     switch (address) {
         case REGION_RDRAM:
             half_to_byte_array((byte*) &n64sys.mem.rdram, HALF_ADDRESS(address) - SREGION_RDRAM, value);
@@ -766,7 +800,7 @@ half n64_read_physical_half(word address) {
 
 void n64_write_physical_byte(word address, byte value) {
     logdebug("Writing 0x%02X to [0x%08X]", value, address);
-    invalidate_dynarec_page(BYTE_ADDRESS(address));
+    invalidate_dynarec_code(BYTE_ADDRESS(address));
     switch (address) {
         case REGION_RDRAM:
             n64sys.mem.rdram[BYTE_ADDRESS(address)] = value;
@@ -6,7 +6,39 @@
 #include "addresses.h"
 
 tlb_entry_t* find_tlb_entry(dword vaddr, int* entry_number);
-bool tlb_probe(dword vaddr, bus_access_t bus_access, word* paddr, int* entry_number);
+bool tlb_probe_slow(dword vaddr, bus_access_t bus_access, word* paddr, int* entry_number);
+
+// Successful TLB translations, by 4KiB virtual page, so mapped accesses don't need to scan the whole TLB. Entries are
+// only valid while the CP0 translation generation they were filled under is current, which covers TLB writes, ASID
+// changes and mode changes.
+#define SOFT_TLB_SIZE 1024 // Power of 2
+#define SOFT_TLB_PAGE_SIZE 0x1000 // The smallest TLB page
+
+typedef struct soft_tlb_entry {
+    dword virtual_page;
+    word physical_page;
+    word generation;
+    // Stores to pages that aren't dirty go through the full lookup, so they still raise TLB modification exceptions.
+    bool writable;
+} soft_tlb_entry_t;
+
+extern soft_tlb_entry_t soft_tlb[SOFT_TLB_SIZE];
+// Needed whenever the translation generation goes back to 0
+void soft_tlb_flush();
+
+INLINE bool tlb_probe(dword vaddr, bus_access_t bus_access, word* paddr, int* entry_number) {
+    soft_tlb_entry_t* cached = &soft_tlb[(vaddr / SOFT_TLB_PAGE_SIZE) & (SOFT_TLB_SIZE - 1)];
+    bool hit = cached->virtual_page == (vaddr & ~(dword)(SOFT_TLB_PAGE_SIZE - 1))
+            && cached->generation == N64CP0.translation_generation
+            && (bus_access != BUS_STORE || cached->writable);
+    if (likely(hit && entry_number == NULL)) {
+        if (paddr != NULL) {
+            *paddr = cached->physical_page | (vaddr & (SOFT_TLB_PAGE_SIZE - 1));
+        }
+        return true;
+    }
+    return tlb_probe_slow(vaddr, bus_access, paddr, entry_number);
+}
 
 #define REGION_XKUSEG 0x0000000000000000 ... 0x000000FFFFFFFFFF
 #define REGION_XBAD1  0x0000010000000000 ... 0x3FFFFFFFFFFFFFFF
@@ -163,6 +195,8 @@ INLINE word resolve_virtual_address_or_die(dword virtual, bus_access_t bus_acces
     return physical;
 }
 
+bool is_idle_poll_address(word physical_address);
+
 void n64_write_physical_dword(word address, dword value);
 dword n64_read_physical_dword(word address);
 
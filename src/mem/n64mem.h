@@ -88,7 +88,7 @@ INLINE void assert_is_flash(n64_save_type_t save_type) {
 }
 
 typedef struct n64_mem {
-    byte rdram[N64_RDRAM_SIZE];
+    byte rdram[N64_RDRAM_SIZE] __attribute__((aligned(4096))); // page aligned for fastmem
     n64_rom_t rom;
     word rdram_reg[10];
     word pi_reg[13];
@@ -245,6 +245,23 @@ INLINE void rdp_on_full_sync() {
     }
 }
 
+INLINE void rdp_dispatch_command(byte command, int command_length, word* buffer) {
+    // Don't need to process commands under 8
+    if (command >= 8) {
+        rdp_enqueue_command(command_length, buffer);
+    }
+
+    if (command == RDP_COMMAND_FULL_SYNC) {
+        rdp_on_full_sync();
+        interrupt_raise(INTERRUPT_DP);
+    }
+}
+
+void rdp_run_hle_command(word* command) {
+    byte id = (command[0] >> 24) & 0x3F;
+    rdp_dispatch_command(id, command_lengths[id], command);
+}
+
 void process_rdp_list() {
     static int last_run_unprocessed_words = 0;
 
@@ -320,15 +337,7 @@ void process_rdp_list() {
         }
 
 
-        // Don't need to process commands under 8
-        if (command >= 8) {
-            rdp_enqueue_command(command_length, &rdp_command_buffer[buf_index]);
-        }
-
-        if (command == RDP_COMMAND_FULL_SYNC) {
-            rdp_on_full_sync();
-            interrupt_raise(INTERRUPT_DP);
-        }
+        rdp_dispatch_command(command, command_length, &rdp_command_buffer[buf_index]);
 
         buf_index += command_length;
     }
@@ -14,6 +14,9 @@ void rdp_cleanup();
 void rdp_run_command();
 void rdp_update_screen();
 void rdp_status_reg_write(word value);
+// Sends a command straight to the RDP, for commands generated by HLE of the graphics microcode instead of read out of
+// RDRAM or DMEM. Must be a complete command.
+void rdp_run_hle_command(word* command);
 GFX_INFO get_gfx_info();
 
 #ifdef __cplusplus
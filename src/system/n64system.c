@@ -9,6 +9,9 @@
 #include <interface/ai.h>
 #include <cpu/rsp.h>
 #include <cpu/dynarec/dynarec.h>
+#include <cpu/dynarec/fastmem.h>
+#include <cpu/dynarec/dynarec_cache.h>
+#include <cpu/dynarec/dynarec_worker.h>
 #ifndef N64_WIN
 #include <sys/mman.h>
 #include <errno.h>
@@ -44,12 +47,14 @@ bool n64_should_quit() {
 void n64_load_rom(const char* rom_path) {
     logalways("Loading %s", rom_path);
     load_n64rom(&n64sys.mem.rom, rom_path);
+    fastmem_map_rom(n64sys.mem.rom.rom, n64sys.mem.rom.size);
     gamedb_match(&n64sys);
     devices_init(n64sys.mem.save_type);
     init_savedata(&n64sys.mem, rom_path);
     if (n64sys.rom_path != rom_path) {
         strcpy(n64sys.rom_path, rom_path);
     }
+    dynarec_cache_open(n64sys.rom_path);
 }
 
 void mprotect_error(const char* thing) {
@@ -101,6 +106,7 @@ void init_n64system(const char* rom_path, bool enable_frontend, bool enable_debu
     memset(&n64sys, 0x00, sizeof(n64_system_t));
     memset(&N64CPU, 0x00, sizeof(N64CPU));
     memset(&N64RSP, 0x00, sizeof(N64RSP));
+    soft_tlb_flush();
     init_mem(&n64sys.mem);
 
     n64sys.video_type = video_type;
@@ -174,6 +180,7 @@ void reset_n64system() {
     memset(n64sys.mem.rdram, 0, N64_RDRAM_SIZE);
     memset(N64RSP.sp_dmem, 0, SP_DMEM_SIZE);
     memset(N64RSP.sp_imem, 0, SP_IMEM_SIZE);
+    rsp_dynarec_imem_written(N64RSPDYNAREC);
     memset(n64sys.mem.pif_ram, 0, PIF_RAM_SIZE);
 
     n64sys.vi.num_halflines = 262;
@@ -185,7 +192,42 @@ void reset_n64system() {
     scheduler_reset();
 }
 
-INLINE int jit_system_step() {
+// The number of cycles the CPU can run for before something else needs to happen: the end of the current VI halfline,
+// the next scheduler event, or a compare interrupt. The JIT runs for this long at a time, and idle loops skip ahead by it.
+INLINE int cycles_until_next_event(int cycles_left_in_halfline) {
+    dword budget = cycles_left_in_halfline > 0 ? cycles_left_in_halfline : 0;
+
+    dword until_event = scheduler_cycles_until_next_event();
+    if (until_event < budget) {
+        budget = until_event;
+    }
+
+    // Count increments at half the CPU's speed, see the compare check in advance_count()
+    if ((N64CP0.count >> 1) < N64CP0.compare) {
+        dword until_compare = ((dword)N64CP0.compare << 1) - N64CP0.count;
+        if (until_compare < budget) {
+            budget = until_compare;
+        }
+    }
+
+    // Always run at least one block
+    return budget > 0 ? budget : 1;
+}
+
+// Moves COUNT forward by a number of cycles at once, raising the compare interrupt if it went past COMPARE.
+INLINE void advance_count(int cycles) {
+    uint64_t oldcount = N64CP0.count >> 1;
+    uint64_t newcount = (N64CP0.count + (cycles * CYCLES_PER_INSTR)) >> 1;
+    if (unlikely(oldcount < N64CP0.compare && newcount >= N64CP0.compare)) {
+        N64CP0.cause.ip7 = true;
+        loginfo("Compare interrupt! oldcount: 0x%08lX newcount: 0x%08lX compare 0x%08X", oldcount, newcount, N64CP0.compare);
+        r4300i_interrupt_update();
+    }
+    N64CP0.count += cycles;
+    N64CP0.count &= 0x1FFFFFFFF;
+}
+
+INLINE int jit_system_step(int cycle_budget) {
     /* Commented out for now since the game never actually reads cp0.random
      * TODO: when a game does, consider generating a random number rather than updating this every instruction
     if (N64CP0.random <= N64CP0.wired) {
@@ -203,18 +245,8 @@ INLINE int jit_system_step() {
         }
     }
     static int cpu_steps = 0;
-    int taken = n64_dynarec_step();
-    {
-        uint64_t oldcount = N64CP0.count >> 1;
-        uint64_t newcount = (N64CP0.count + (taken * CYCLES_PER_INSTR)) >> 1;
-        if (unlikely(oldcount < N64CP0.compare && newcount >= N64CP0.compare)) {
-            N64CP0.cause.ip7 = true;
-            loginfo("Compare interrupt! oldcount: 0x%08lX newcount: 0x%08lX compare 0x%08X", oldcount, newcount, N64CP0.compare);
-            r4300i_interrupt_update();
-        }
-        N64CP0.count += taken;
-        N64CP0.count &= 0x1FFFFFFFF;
-    }
+    int taken = n64_dynarec_step(cycle_budget);
+    advance_count(taken);
     cpu_steps += taken;
 
     if (!N64RSP.status.halt) {
@@ -233,7 +265,7 @@ INLINE int jit_system_step() {
     return taken;
 }
 
-INLINE int interpreter_system_step() {
+INLINE int interpreter_system_step(int cycles_left_in_halfline) {
 #ifdef N64_DEBUG_MODE
 #ifndef N64_WIN
     if (n64sys.debugger_state.enabled && check_breakpoint(&n64sys.debugger_state, N64CPU.pc)) {
@@ -247,6 +279,16 @@ INLINE int interpreter_system_step() {
 #endif
     int taken = CYCLES_PER_INSTR;
     r4300i_step();
+    if (r4300i_in_idle_loop()) {
+        // Nothing will change until the next event, so skip straight to it. The RSP catches up below.
+        // COUNT has already moved for this instruction, so this stops a cycle short of a compare match, which
+        // r4300i_step() then raises as usual.
+        int skipped = cycles_until_next_event(cycles_left_in_halfline) - taken;
+        if (skipped > 0) {
+            advance_count(skipped);
+            taken += skipped;
+        }
+    }
     static int cpu_steps = 0;
     cpu_steps += taken;
 
@@ -282,7 +324,7 @@ void handle_scheduler_event(scheduler_event_t* event) {
 void n64_system_step(bool dynarec) {
     int taken;
     if (dynarec) {
-        taken = jit_system_step();
+        taken = jit_system_step(1);
     } else {
         r4300i_step();
         taken = 1;
@@ -314,7 +356,7 @@ void jit_system_loop() {
                 check_vi_interrupt();
 
                 while (cycles <= n64sys.vi.cycles_per_halfline) {
-                    int taken = jit_system_step();
+                    int taken = jit_system_step(cycles_until_next_event(n64sys.vi.cycles_per_halfline - cycles + 1));
                     ai_step(taken);
                     static scheduler_event_t event;
                     if (scheduler_tick(taken, &event)) {
@@ -361,7 +403,7 @@ void interpreter_system_loop() {
                 check_vi_interrupt();
 
                 while (cycles <= n64sys.vi.cycles_per_halfline) {
-                    int taken = interpreter_system_step();
+                    int taken = interpreter_system_step(n64sys.vi.cycles_per_halfline - cycles + 1);
                     ai_step(taken);
                     static scheduler_event_t event;
                     if (scheduler_tick(taken, &event)) {
@@ -408,6 +450,9 @@ void n64_system_loop() {
 
 void n64_system_cleanup() {
     rdp_cleanup();
+    // Anything still being compiled is thrown away, so it can't be installed into a freed dynarec.
+    dynarec_worker_stop();
+    dynarec_cache_save();
     if (n64sys.dynarec != NULL) {
         free(n64sys.dynarec);
         n64sys.dynarec = NULL;
@@ -187,6 +187,8 @@ typedef struct n64_system {
     n64_dynarec_t *dynarec;
     softrdp_state_t softrdp_state;
     bool use_interpreter;
+    bool hle_audio; // Run audio tasks with rsp_hle instead of on the RSP
+    bool hle_gfx;   // Same for graphics tasks
     char rom_path[PATH_MAX];
 } n64_system_t;
 
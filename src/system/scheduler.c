@@ -76,3 +76,15 @@ void scheduler_enqueue_absolute(dword at_ticks, scheduler_event_type_t event_typ
 void scheduler_enqueue_relative(dword in_ticks, scheduler_event_type_t event_type) {
     scheduler_enqueue_absolute(scheduler_ticks + in_ticks, event_type);
 }
+
+// Returns how many cycles scheduler_tick() has to be called with before the next event happens, or UINT64_MAX if
+// there's nothing scheduled.
+dword scheduler_cycles_until_next_event() {
+    if (scheduler_list == NULL) {
+        return UINT64_MAX;
+    } else if (scheduler_list->event.time < scheduler_ticks) {
+        return 0;
+    } else {
+        return scheduler_list->event.time - scheduler_ticks + 1;
+    }
+}
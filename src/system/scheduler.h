@@ -19,5 +19,6 @@ void scheduler_reset();
 bool scheduler_tick(dword cycles, scheduler_event_t* event);
 void scheduler_enqueue_absolute(dword at_cycles, scheduler_event_type_t event_type);
 void scheduler_enqueue_relative(dword in_cycles, scheduler_event_type_t event_type);
+dword scheduler_cycles_until_next_event();
 
 #endif //N64_SCHEDULER_H
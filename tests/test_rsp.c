@@ -10,6 +10,7 @@
 #include <cpu/rsp.h>
 #include <mem/mem_util.h>
 #include <cpu/n64_rsp_bus.h>
+#include <cpu/dynarec/rsp_dynarec.h>
 
 // Just to make sure we don't get caught in an infinite loop
 #define MAX_CYCLES 100000
@@ -33,6 +34,7 @@ void load_rsp_imem(const char* rsp_path) {
         N64RSP.icache[i].instruction.raw = word_from_byte_array(N64RSP.sp_imem, i * 4);
         N64RSP.icache[i].handler = cache_rsp_instruction;
     }
+    rsp_dynarec_imem_written(N64RSPDYNAREC);
 }
 
 void load_rsp_dmem(word* input, int input_size) {
@@ -41,23 +43,34 @@ void load_rsp_dmem(word* input, int input_size) {
     }
 }
 
-bool run_test(word* input, int input_size, word* output, int output_size) {
-    load_rsp_dmem(input, input_size / 4);
-
+void run_rsp(bool use_dynarec) {
     N64RSP.status.halt = false;
     N64RSP.pc = 0;
 
-    int cycles = 0;
-
-    while (!N64RSP.status.halt) {
-        if (cycles >= MAX_CYCLES) {
+    if (use_dynarec) {
+        // Compiled blocks take what they run out of this themselves, the break instruction sets it to 0
+        N64RSP.steps = MAX_CYCLES;
+        while (N64RSP.steps > 0) {
+            rsp_dynarec_step();
+        }
+        if (!N64RSP.status.halt) {
             logfatal("Test ran too long and was killed! Possible infinite loop?");
         }
+    } else {
+        int cycles = 0;
+
+        while (!N64RSP.status.halt) {
+            if (cycles >= MAX_CYCLES) {
+                logfatal("Test ran too long and was killed! Possible infinite loop?");
+            }
 
-        cycles++;
-        rsp_step();
+            cycles++;
+            rsp_step();
+        }
     }
+}
 
+bool check_output(byte* output, int output_size) {
     bool failed = false;
     printf("\n\n================= Expected =================    ================== Actual ==================\n");
     printf("          0 1 2 3  4 5 6 7  8 9 A B  C D E F              0 1 2 3  4 5 6 7  8 9 A B  C D E F\n");
@@ -69,7 +82,7 @@ bool run_test(word* input, int input_size, word* output, int output_size) {
                 printf(" ");
             }
             if (i + b < output_size) {
-                printf("%02X", ((byte*)output)[i + b]);
+                printf("%02X", output[i + b]);
             } else {
                 printf("  ");
             }
@@ -83,7 +96,7 @@ bool run_test(word* input, int input_size, word* output, int output_size) {
             }
             if (i + b < output_size) {
                 byte actual = N64RSP.sp_dmem[BYTE_ADDRESS(0x800 + i + b)];
-                byte expected = ((byte*)output)[i + b];
+                byte expected = output[i + b];
 
                 if (actual != expected) {
                     printf(COLOR_RED);
@@ -107,21 +120,55 @@ bool run_test(word* input, int input_size, word* output, int output_size) {
     return failed;
 }
 
+bool run_test(word* input, int input_size, byte* output, int output_size, bool use_dynarec) {
+    load_rsp_dmem(input, input_size / 4);
+    run_rsp(use_dynarec);
+    return check_output(output, output_size);
+}
+
+// Checks the dynarec against the interpreter instead of the golden, for tests the interpreter doesn't pass yet.
+bool run_compare_test(word* input, int input_size, int output_size) {
+    load_rsp_dmem(input, input_size / 4);
+    byte dmem[SP_DMEM_SIZE];
+    memcpy(dmem, N64RSP.sp_dmem, SP_DMEM_SIZE);
+
+    run_rsp(false);
+    byte expected[output_size];
+    for (int i = 0; i < output_size; i++) {
+        expected[i] = N64RSP.sp_dmem[BYTE_ADDRESS(0x800 + i)];
+    }
+
+    memcpy(N64RSP.sp_dmem, dmem, SP_DMEM_SIZE);
+    run_rsp(true);
+    return check_output(expected, output_size);
+}
+
 void load_test(const char* rsp_path) {
     init_n64system(NULL, false, false, UNKNOWN_VIDEO_TYPE, false);
     load_rsp_imem(rsp_path);
 }
 
+bool recomp(const char* arg) {
+    return strcmp(arg, "recomp") == 0;
+}
+
+bool compare(const char* arg) {
+    return strcmp(arg, "compare") == 0;
+}
+
 int main(int argc, char** argv) {
-    if (argc < 5) {
+    if (argc < 6) {
         logfatal("Not enough arguments");
     }
 
     log_set_verbosity(LOG_VERBOSITY_DEBUG);
 
     const char* test_name = argv[1];
-    int input_size = atoi(argv[2]);
-    int output_size = atoi(argv[3]);
+    // interp and recomp check against the golden, compare checks the dynarec against the interpreter
+    bool use_dynarec = recomp(argv[2]);
+    bool compare_to_interpreter = compare(argv[2]);
+    int input_size = atoi(argv[3]);
+    int output_size = atoi(argv[4]);
 
     if (input_size % 4 != 0) {
         logfatal("Invalid input size: %d is not divisible by 4.", input_size);
@@ -148,19 +195,24 @@ int main(int argc, char** argv) {
 
     load_test(rsp_path);
 
-    for (int i = 4; i < argc; i++) {
+    for (int i = 5; i < argc; i++) {
         const char* subtest_name = argv[i];
         byte input[input_size];
         fread(input, 1, input_size, input_data_handle);
         byte output[output_size];
         fread(output, 1, output_size, output_data_handle);
 
-        bool subtest_failed = run_test((word *) input, input_size, (word *) output, output_size);
+        bool subtest_failed;
+        if (compare_to_interpreter) {
+            subtest_failed = run_compare_test((word *) input, input_size, output_size);
+        } else {
+            subtest_failed = run_test((word *) input, input_size, output, output_size, use_dynarec);
+        }
 
         if (subtest_failed) {
-            printf("[%s %s] FAILED\n", test_name, subtest_name);
+            printf("[%s %s %s] FAILED\n", test_name, argv[2], subtest_name);
         } else {
-            printf("[%s %s] PASSED\n", test_name, subtest_name);
+            printf("[%s %s %s] PASSED\n", test_name, argv[2], subtest_name);
         }
 
         failed |= subtest_failed;
@@ -30,6 +30,9 @@ def get_just_filename(path: str):
     return name
 
 
+# The interpreter doesn't match these goldens yet (LFV/SFV), so they also check the dynarec against the interpreter.
+compare_tests = ["memaccess", "lfv_sfv"]
+
 for filename in glob.glob("./input/*.toml"):
     test_name = get_just_filename(filename)
 
@@ -54,12 +57,17 @@ for filename in glob.glob("./input/*.toml"):
 
     input_data.close()
 
-    addtest_line = "add_test(NAME test_rsp_%s COMMAND test_rsp %s %d %d" % (test_name, test_name, input_size, output_size)
+    modes = ["interp", "recomp"]
+    if test_name in compare_tests:
+        modes.append("compare")
+
+    for mode in modes:
+        addtest_line = "add_test(NAME test_rsp_%s_%s COMMAND test_rsp %s %s %d %d" % (test_name, mode, test_name, mode, input_size, output_size)
 
-    for name in test_names:
-        addtest_line += " " + name
-    addtest_line += ")\n"
+        for name in test_names:
+            addtest_line += " " + name
+        addtest_line += ")\n"
 
-    cmakelists.write(addtest_line)
+        cmakelists.write(addtest_line)
 
 cmakelists.close()